@@ -0,0 +1,354 @@
+/* latency benchmark: replay recorded gestures (e.g. test cases) through the
+   incremental matcher running in its own thread (as in the keyboard plugin),
+   with original points timing.
+   This reports post-lift latency distribution (i.e. time between end of
+   gesture and result) and matching statistics, and optionally writes
+   everything as JSON for comparing runs */
+
+#include "config.h"
+#include "curve_match.h"
+#include "incr_match.h"
+#include "thread.h"
+#include "replay.h"
+
+#include <QString>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSemaphore>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+
+#include <iostream>
+using namespace std;
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#ifndef THREAD
+#error "benchmark requires thread support (see config.h)"
+#endif /* THREAD */
+
+static void usage(char *progname) {
+  cout << "usage:" << endl;
+  cout << progname << " [<options>] <tree file or directory> <test json> [<test json> ...]" << endl;
+  cout << "(test files may also be binary gesture files, cf. \"cli -C\")" << endl;
+  cout << "(if a directory is given, tree file is found by name from each test file)" << endl;
+  cout << "options:" << endl;
+  cout << " -d : default parameters" << endl;
+  cout << " -g : enable debug mode" << endl;
+  cout << " -t <ms> : deadline for final matching" << endl;
+  cout << " -x <factor> : replay speed (default: 1 = real time, 0 = no delay between points)" << endl;
+  cout << " -r <count> : play all gestures this number of times (for comparisons, cf. tools/bench_compare.py)" << endl;
+  cout << " -c <mode> : unload dictionary before each gesture to measure first gesture penalty" << endl;
+  cout << "             (1 = cold start: full reload, 2 = warm restore from snapshot)" << endl;
+  cout << " -m : enable memory accounting (mem_* statistics, this adds some overhead)" << endl;
+  cout << " -o <file> : write results as JSON" << endl;
+  exit(1);
+}
+
+class BenchCallBack : public ThreadCallBack {
+ public:
+  QElapsedTimer timer; // started when gesture is complete
+  qint64 latency_ns;
+  int candidates;
+  QSemaphore done;
+
+  void call(QList<ScenarioDto> result, int /* deadline */, bool /* truncated */) {
+    latency_ns = timer.nsecsElapsed();
+    candidates = result.size();
+    done.release();
+  }
+};
+
+static QString findTree(QString tree, QString treefile) {
+  if (! QFileInfo(tree).isDir()) { return tree; }
+  QString name = QFileInfo(treefile).fileName();
+  if (name.isEmpty()) { name = "en.tre"; }
+  return tree + "/" + name;
+}
+
+static QSharedPointer<MatchEngine> getEngine(QHash<QString, QSharedPointer<MatchEngine> > &engines, QString treeFile, bool debug) {
+  /* one engine per tree file */
+  if (! engines.contains(treeFile)) {
+    QSharedPointer<MatchEngine> engine = CurveMatch::createEngine();
+    engine->setDebug(debug);
+    if (! engine->loadTree(treeFile, Params::fromJson(QJsonObject()))) { // default parameters
+      cerr << "Error loading tree file: " << treeFile.toUtf8().constData() << endl;
+      engine.clear();
+    }
+    engines[treeFile] = engine;
+  }
+  return engines[treeFile];
+}
+
+static bool replay(IncrementalMatch *cm, QString treeFile,
+		   bool defparam, bool debug, int deadline, float speed, int cold, bool mem_stats, QJsonObject &json) {
+  /* play one gesture (already loaded in cm, which is deleted afterwards),
+     and return its statistics as JSON */
+  cm->setDebug(debug);
+  if (defparam) { cm->useDefaultParameters(); }
+  if (mem_stats) { cm->getParamsPtr()->mem_stats = 1; }
+
+  // snapshots are only used by warm restore runs: otherwise the thread exit
+  // below (EVT_QUIT) would write a "-warm.snap" file next to the tree
+  cm->getParamsPtr()->warm_restore = (cold == 2);
+
+  if (cold) {
+    // same as auto-unload after idle (cf. CurveThread::run): dictionary is
+    // loaded again by the matcher thread when the gesture starts
+    cm->saveSnapshot(true);
+    cm->loadTree(QString());
+  }
+
+  QList<CurvePoint> points = cm->getCurve();
+  if (points.size() < 2) { delete cm; return false; }
+
+  BenchCallBack callback;
+  CurveThread t;
+  t.setMatcher(cm);
+  t.setCallBack(&callback);
+  t.loadTree(treeFile); // already loaded by engine, so this is cheap
+  t.clearCurve();
+
+  double start_cpu_time = getCPUTime();
+  QElapsedTimer clock;
+  clock.start();
+  int t0 = points[0].t;
+  foreach(CurvePoint p, points) {
+    if (p.end_marker) {
+      t.endOneCurve(p.curve_id);
+      continue;
+    }
+    if (speed > 0) {
+      qint64 wait = (qint64) ((p.t - t0) / speed) - clock.elapsed();
+      if (wait > 0) { usleep(1000 * wait); }
+    }
+    t.addPoint(p, p.curve_id, p.t);
+  }
+  int draw_time = clock.elapsed();
+
+  callback.timer.start();
+  t.endCurve(-1, deadline);
+  callback.done.acquire();
+
+  double cpu_time = getCPUTime() - start_cpu_time;
+  stats_t st = cm->getStats();
+  t.stopThread();
+  delete cm;
+
+  json["points"] = points.size();
+  json["draw_time"] = draw_time;
+  json["latency"] = (double) callback.latency_ns / 1000000;
+  json["cputime"] = 1000 * cpu_time;
+  json["count"] = st.st_count;
+  json["fork"] = st.st_fork;
+  json["retry"] = st.st_retry;
+  json["skim"] = st.st_skim;
+  json["cache_hit"] = st.st_cache_hit;
+  json["cache_miss"] = st.st_cache_miss;
+  json["truncated"] = st.st_truncated;
+  json["mem_peak"] = st.st_mem_peak;
+  json["mem_snapshot"] = st.st_mem_snapshot;
+  json["cold"] = st.st_cold;
+  json["load_restored"] = st.st_load_restored;
+  json["t_load_tree"] = st.st_t_load_tree;
+  json["t_load_user"] = st.st_t_load_user;
+  json["t_load_keys"] = st.st_t_load_keys;
+  json["candidates"] = callback.candidates;
+  json["t_preprocess"] = st.st_t_preprocess;
+  json["t_expand"] = st.st_t_expand;
+  json["t_filter"] = st.st_t_filter;
+  json["t_fallback"] = st.st_t_fallback;
+  json["t_postprocess"] = st.st_t_postprocess;
+  json["t_sort"] = st.st_t_sort;
+  return true;
+}
+
+static double percentile(const QList<double> &sorted, int p) {
+  /* nearest-rank method */
+  int rank = (int) ceil(p * sorted.size() / 100.0);
+  if (rank < 1) { rank = 1; }
+  return sorted[rank - 1];
+}
+
+static QJsonObject distribution(QList<double> values) {
+  QJsonObject json;
+  if (! values.size()) { return json; }
+  qSort(values);
+  double sum = 0;
+  foreach(double v, values) { sum += v; }
+  json["avg"] = sum / values.size();
+  json["p50"] = percentile(values, 50);
+  json["p95"] = percentile(values, 95);
+  json["p99"] = percentile(values, 99);
+  json["max"] = values.last();
+  return json;
+}
+
+static void display(const char *name, QJsonObject json) {
+  char tmp[256];
+  snprintf(tmp, sizeof(tmp), "%-10s avg=%10.2f p50=%10.2f p95=%10.2f p99=%10.2f max=%10.2f", name,
+	   json["avg"].toDouble(), json["p50"].toDouble(), json["p95"].toDouble(),
+	   json["p99"].toDouble(), json["max"].toDouble());
+  cout << tmp << endl;
+}
+
+int main(int argc, char* argv[]) {
+  bool defparam = false;
+  bool debug = false;
+  int deadline = 0;
+  float speed = 1;
+  int repeat = 1;
+  int cold = 0;
+  bool mem_stats = false;
+  QString output;
+
+  extern char *optarg;
+  extern int optind;
+
+  int c;
+  while ((c = getopt(argc, argv, "dgt:x:r:c:mo:")) != -1) {
+    switch (c) {
+    case 'd': defparam = true; break;
+    case 'g': debug = true; break;
+    case 't': deadline = atoi(optarg); break;
+    case 'x': speed = atof(optarg); break;
+    case 'r': repeat = max(1, atoi(optarg)); break;
+    case 'c': cold = atoi(optarg); break;
+    case 'm': mem_stats = true; break;
+    case 'o': output = optarg; break;
+    default: usage(argv[0]); break;
+    }
+  }
+
+  if (! (argc > optind + 1)) { usage(argv[0]); }
+  QString tree = argv[optind];
+
+  QHash<QString, QSharedPointer<MatchEngine> > engines; // one per tree file
+  QJsonArray json_gestures;
+  QList<double> latency, cputime, count, fork, retry, load;
+  int cache_hit = 0, cache_miss = 0, failed = 0;
+
+  ReplayFile replayFile;
+  int arg = optind + 1;
+  int gesture = 0;
+  int run = 0;
+  while (run < repeat) {
+    // runs are interleaved (all gestures, then all gestures again ...), so
+    // slow drifts (e.g. CPU frequency) affect all gestures the same way
+    if (arg >= argc) { arg = optind + 1; run ++; continue; }
+
+    QString fileName;
+    QString treeFile;
+    IncrementalMatch *cm = NULL;
+
+    if (! replayFile.isOpen() && ReplayFile::isReplayFile(argv[arg])) {
+      if (! replayFile.open(argv[arg])) { cerr << "Can't open: " << argv[arg] << endl; failed ++; arg ++; continue; }
+      gesture = 0;
+    }
+
+    if (replayFile.isOpen()) {
+      // binary gesture file: no parsing at all
+      if (gesture >= replayFile.getCount()) { replayFile.close(); arg ++; continue; }
+      const replay_gesture_t *g = replayFile.getGesture(gesture);
+      fileName = QString::fromUtf8(g->name);
+      treeFile = findTree(tree, QString::fromUtf8(g->treefile));
+      QSharedPointer<MatchEngine> engine = getEngine(engines, treeFile, debug);
+      if (! engine.isNull()) {
+	cm = new IncrementalMatch(engine);
+	cm->fromReplay(replayFile, gesture);
+      }
+      gesture ++;
+    } else {
+      fileName = argv[arg ++];
+      QFile file(fileName);
+      if (! file.open(QFile::ReadOnly)) { cerr << "Can't open: " << fileName.toUtf8().constData() << endl; failed ++; continue; }
+      QJsonObject input = QJsonDocument::fromJson(file.readAll()).object();
+      file.close();
+      if (input.contains("input")) { input = input["input"].toObject(); }
+
+      treeFile = findTree(tree, input["treefile"].toString());
+      QSharedPointer<MatchEngine> engine = getEngine(engines, treeFile, debug);
+      if (! engine.isNull()) {
+	cm = new IncrementalMatch(engine);
+	cm->fromJson(input);
+      }
+    }
+
+    QJsonObject json;
+    if (! cm || ! replay(cm, treeFile, defparam, debug, deadline, speed, cold, mem_stats, json)) {
+      cerr << "Skipped: " << fileName.toUtf8().constData() << endl;
+      failed ++;
+      continue;
+    }
+    json["file"] = QFileInfo(fileName).fileName();
+    json["treefile"] = QFileInfo(treeFile).fileName();
+    json["run"] = run;
+    json_gestures.append(json);
+
+    latency.append(json["latency"].toDouble());
+    cputime.append(json["cputime"].toDouble());
+    count.append(json["count"].toDouble());
+    fork.append(json["fork"].toDouble());
+    retry.append(json["retry"].toDouble());
+    if (json["cold"].toInt()) {
+      load.append((json["t_load_tree"].toDouble() + json["t_load_user"].toDouble() + json["t_load_keys"].toDouble()) / 1000);
+    }
+    cache_hit += json["cache_hit"].toInt();
+    cache_miss += json["cache_miss"].toInt();
+
+    cerr << QFileInfo(fileName).fileName().toUtf8().constData() << ": " << json["latency"].toDouble() << "ms" << endl;
+  }
+
+  QJsonObject summary;
+  summary["gestures"] = latency.size();
+  summary["failed"] = failed;
+  summary["latency"] = distribution(latency);
+  summary["cputime"] = distribution(cputime);
+  summary["count"] = distribution(count);
+  summary["fork"] = distribution(fork);
+  summary["retry"] = distribution(retry);
+  if (load.size()) { summary["load"] = distribution(load); }
+  summary["cache_hit_ratio"] = (cache_hit + cache_miss)?((double) cache_hit / (cache_hit + cache_miss)):0;
+
+  cout << "Gestures: " << latency.size() << " (failed: " << failed << ")";
+  if (repeat > 1) { cout << " in " << repeat << " runs"; }
+  cout << endl;
+  display("latency", summary["latency"].toObject());
+  display("cputime", summary["cputime"].toObject());
+  display("nodes", summary["count"].toObject());
+  display("forks", summary["fork"].toObject());
+  display("retries", summary["retry"].toObject());
+  if (load.size()) { display("load (ms)", summary["load"].toObject()); }
+  cout << "Cache hit ratio: " << 100 * summary["cache_hit_ratio"].toDouble() << "%" << endl;
+
+  if (! output.isEmpty()) {
+    QJsonObject json;
+    QJsonObject json_options;
+    json_options["speed"] = speed;
+    json_options["deadline"] = deadline;
+    json_options["default_params"] = defparam;
+    json_options["repeat"] = repeat;
+    json_options["cold"] = cold;
+    json["ts"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    json["options"] = json_options;
+    json["summary"] = summary;
+    json["gestures"] = json_gestures;
+
+    QFile file(output);
+    if (! file.open(QFile::WriteOnly | QFile::Truncate)) {
+      cerr << "Can't write: " << output.toUtf8().constData() << endl;
+      return 1;
+    }
+    file.write(QJsonDocument(json).toJson());
+    file.close();
+  }
+
+  return latency.size()?0:2;
+}
@@ -0,0 +1,21 @@
+TARGET = curvebench
+
+PROJECTNAME = curvebench
+
+TEMPLATE = app
+CONFIG += qt release
+QT += qml quick
+
+DEPENDPATH += .
+INCLUDEPATH += ../curve
+
+SOURCES += bench.cpp ../curve/curve_match.cpp ../curve/tree.cpp ../curve/score.cpp ../curve/incr_match.cpp ../curve/functions.cpp ../curve/thread.cpp ../curve/multi.cpp ../curve/scenario.cpp ../curve/kb_distort.cpp ../curve/key_shift.cpp ../curve/log.cpp ../curve/event_queue.cpp ../curve/engine.cpp ../curve/batch.cpp ../curve/shortlist.cpp ../curve/trace.cpp ../curve/replay.cpp
+HEADERS += ../curve/curve_match.h ../curve/tree.h ../curve/params.h ../curve/score.h ../curve/incr_match.h ../curve/functions.h ../curve/thread.h ../curve/log.h ../curve/multi.h ../curve/config.h ../curve/scenario.h ../curve/kb_distort.h  ../curve/key_shift.h ../curve/event_queue.h ../curve/engine.h ../curve/batch.h ../curve/shortlist.h ../curve/trace.h ../curve/replay.h
+
+DESTDIR = build
+OBJECTS_DIR = $$DESTDIR
+MOC_DIR = $$DESTDIR
+RCC_DIR = $$DESTDIR
+UI_DIR = $$DESTDIR
+
+QMAKE_CXXFLAGS += -Wno-psabi
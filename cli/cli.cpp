@@ -3,6 +3,9 @@
 #include "config.h"
 #include "curve_match.h"
 #include "tree.h"
+#include "batch.h"
+#include "trace.h"
+#include "replay.h"
 
 #ifdef INCREMENTAL
 #include "incr_match.h"
@@ -14,8 +17,11 @@
 
 #include <QString>
 #include <QFile>
+#include <QFileInfo>
+#include <QRegExp>
 #include <QTextStream>
 #include <QTextCodec>
+#include <QMutex>
 
 #include <iostream>
 using namespace std;
@@ -31,10 +37,13 @@ static void usage(char *progname) {
   cout << progname << " -L <tree file> <word>         add word to user dictionary" << endl;
   cout << progname << " -D <tree file>                dump dictionary (incl. user's)" << endl;
   cout << progname << " -G <tree file> <letters key>  get words for key" << endl;
+  cout << progname << " -C <output> <input json> [<input json> ...]  convert gestures to binary format (for fast replay)" << endl;
+  cout << "(input may also be a binary gesture file: all gestures are replayed)" << endl;
   cout << "options:" << endl;
   cout << " -d : default parameters" << endl;
   cout << " -g : disable debug more" << endl;
   cout << " -l <file> : log file" << endl;
+  cout << " -q : do not write log lines to stderr" << endl;
   cout << " -a <nr> : implementation (0:simple, 1:incremental, 2:thread)" << endl;
   cout << " -s : only display scores (instead of full json)" << endl;
   cout << " -m <ms> : delay between curve point feeding (thread mode only)" << endl;
@@ -42,9 +51,86 @@ static void usage(char *progname) {
   cout << " -k <mode> : 0=ignore, 1=load (default), 2=load+save" << endl;
   cout << " -e <word> : sets expected word for \"-k 2\" option" << endl;
   cout << " -f : disable scenario filtering" << endl;
+  cout << " -t <ms> : deadline for final matching (incremental & thread mode only)" << endl;
+  cout << " -b : batch mode: input is a stream of JSON gestures (one per line), output is one JSON result per line" << endl;
+  cout << " -j <count> : number of threads for batch mode (default: one per core)" << endl;
+  cout << " -T <file> : write a timeline trace (chrome trace-event format), same as OKB_TRACE environment variable" << endl;
   exit(1);
 }
 
+class CliBatchCallBack : public BatchCallBack {
+ private:
+  QMutex mutex;
+ public:
+  void result(int /* index */, int /* id */, QString json) {
+    QMutexLocker locker(&mutex);
+    cout << json.toUtf8().constData() << endl;
+  }
+};
+
+static int convert(QString output, int count, char **files) {
+  /* JSON gestures to binary container */
+  ReplayWriter writer;
+  if (! writer.open(output)) {
+    cerr << "Can't write: " << output.toUtf8().constData() << endl;
+    return 1;
+  }
+  for (int i = 0; i < count; i ++) {
+    QFile file(files[i]);
+    if (! file.open(QFile::ReadOnly)) { cerr << "Can't open: " << files[i] << endl; continue; }
+    QJsonObject json = QJsonDocument::fromJson(file.readAll()).object();
+    file.close();
+    QString name = QFileInfo(files[i]).fileName().replace(QRegExp("\\.json$"), "");
+    if (! writer.add(json, name, ReplayWriter::expectedWord(files[i]))) {
+      cerr << "Skipped: " << files[i] << endl;
+    }
+  }
+  int written = writer.getCount();
+  if (! writer.close()) {
+    cerr << "Error writing: " << output.toUtf8().constData() << endl;
+    return 1;
+  }
+  cerr << "Converted " << written << " gestures" << endl;
+  return 0;
+}
+
+static int batch(QString treeFile, QFile &file, ReplayFile &replay, int implem, int threads, bool defparam, bool debug, int deadline) {
+  /* process all gestures from input with a shared engine (i.e. word tree is loaded only once) */
+  QSharedPointer<MatchEngine> engine = CurveMatch::createEngine();
+  engine->setDebug(debug);
+  if (! engine->loadTree(treeFile, Params::fromJson(QJsonObject()))) { // default parameters
+    cerr << "Error loading tree file: " << treeFile.toUtf8().constData() << endl;
+    return 1;
+  }
+
+  CliBatchCallBack callback;
+  BatchMatch batch(engine, &callback, threads);
+  batch.setImplementation(implem);
+  batch.setDefaultParameters(defparam);
+  batch.setDeadline(deadline);
+  batch.setDebug(debug);
+
+  if (replay.isOpen()) {
+    for (int i = 0; i < replay.getCount(); i ++) { batch.add(&replay, i); }
+  } else {
+    QTextStream in(&file);
+    in.setCodec(QTextCodec::codecForName("UTF-8"));
+    QString line = in.readLine();
+    while (! line.isNull()) {
+      if (! line.trimmed().isEmpty()) { batch.add(line); }
+      line = in.readLine();
+    }
+    file.close();
+  }
+
+  batch.waitForDone();
+
+  char tmp[128];
+  snprintf(tmp, sizeof(tmp), "Batch: %d gestures, %.2f gestures/s", batch.getCount(), batch.getRate());
+  cerr << tmp << endl;
+  return 0;
+}
+
 
 int main(int argc, char* argv[]) {
   QString input;
@@ -64,16 +150,22 @@ int main(int argc, char* argv[]) {
   bool no_filt = false;
   int key_error = 1;
   char *expected = NULL;
+  int deadline = 0;
+  bool batch_mode = false;
+  int threads = 0;
+  bool act_convert = false;
+  ReplayFile replay;
 
   extern char *optarg;
   extern int optind;
 
   int c;
-  while ((c = getopt(argc, argv, "dl:a:sgm:r:LDGk:e:f")) != -1) {
+  while ((c = getopt(argc, argv, "dl:qa:sgm:r:LDGCk:e:ft:bj:T:")) != -1) {
     switch (c) {
     case 'a': implem = atoi(optarg); break;
     case 'd': defparam = true; break;
     case 'l': logfile = optarg; break;
+    case 'q': log_setstderr(false); break;
     case 's': showscore = true; break;
     case 'g': debug = false; break;
 #ifdef THREAD
@@ -83,9 +175,14 @@ int main(int argc, char* argv[]) {
     case 'L': act_learn = true; break;
     case 'D': act_dump = true; break;
     case 'G': act_get = true; break;
+    case 'C': act_convert = true; break;
     case 'k': key_error = atoi(optarg); break;
     case 'e': expected = optarg; break;
     case 'f': no_filt = true; break;
+    case 't': deadline = atoi(optarg); break;
+    case 'b': batch_mode = true; break;
+    case 'j': threads = atoi(optarg); break;
+    case 'T': trace_start(QString(optarg)); break;
     default: usage(argv[0]); break;
     }
   }
@@ -95,12 +192,19 @@ int main(int argc, char* argv[]) {
   if (key_error >= 2 && !expected) { usage(argv[0]); }
 
 
+  if (act_convert) {
+    if (! (argc > optind + 1)) { usage(argv[0]); }
+    return convert(QString(argv[optind]), argc - optind - 1, argv + optind + 1);
+  }
+
   if (act_learn) {
     if (! (argc > optind + 1)) { usage(argv[0]); }
   } else if (act_dump || act_get) {
     //
   } else {
-    if (argc > optind + 1) {
+    if (argc > optind + 1 && ReplayFile::isReplayFile(argv[optind+1])) {
+      if (! replay.open(argv[optind+1])) { cerr << "Error loading: " << argv[optind+1] << endl; return 1; }
+    } else if (argc > optind + 1) {
       file.setFileName(argv[optind+1]);
       file.open(QFile::ReadOnly);
     } else if (argc > optind) {
@@ -110,14 +214,21 @@ int main(int argc, char* argv[]) {
     }
   }
 
-  QTextStream in(&file);
-  in.setCodec(QTextCodec::codecForName("UTF-8"));
-  QString line = in.readLine();
-  while (! line.isNull()) {
-    input += line;
-    line = in.readLine();
+  if (batch_mode) {
+    if (implem > 1) { usage(argv[0]); } // thread implementation is not relevant here
+    return batch(QString(argv[optind]), file, replay, implem, threads, defparam, debug, deadline);
+  }
+
+  if (! replay.isOpen()) {
+    QTextStream in(&file);
+    in.setCodec(QTextCodec::codecForName("UTF-8"));
+    QString line = in.readLine();
+    while (! line.isNull()) {
+      input += line;
+      line = in.readLine();
+    }
+    file.close();
   }
-  file.close();
 
   CurveMatch *cm;
   switch (implem) {
@@ -153,8 +264,8 @@ int main(int argc, char* argv[]) {
     cm->dumpDict();
     return 0;
   } else if (act_get) {
-    char* words = cm -> getPayload((unsigned char *) argv[optind + 1]);
-    cout << "Word: " << (words?words:"*not found*") << endl;
+    QString words = cm -> getPayload((unsigned char *) argv[optind + 1]);
+    cout << "Word: " << (words.isNull()?"*not found*":words.toUtf8().constData()) << endl;
     return 0;
   }
 
@@ -164,9 +275,18 @@ int main(int argc, char* argv[]) {
 
   if (implem == 2) { repeat = 1; }
 
-  for (int i = 0; i < repeat; i ++) {
+  // with a binary gesture file, all gestures are played in sequence
+  int gestures = replay.isOpen()?replay.getCount():1;
+
+  for (int i = 0; i < repeat * gestures; i ++) {
     cm->clearCurve();
-    cm->fromString(input);
+    if (replay.isOpen()) {
+      const replay_gesture_t *g = replay.getGesture(i / repeat);
+      cerr << "==> Gesture: " << g->name << " (expected: " << g->expected << ")" << endl;
+      cm->fromReplay(replay, i / repeat);
+    } else {
+      cm->fromString(input);
+    }
     // @todo (must be deactivated in add_point for key_error = 0) if (key_error >= 1) { cm->loadKeyPos(); }
 
     if (defparam) { cm->useDefaultParameters(); }
@@ -174,6 +294,7 @@ int main(int argc, char* argv[]) {
       Params *params = cm->getParamsPtr();
       params->max_active_scenarios = params->max_active_scenarios2 = 1000000;
     }
+    cm->prepareIndex(true); // results must not depend on dictionary index build time
 
 
     QList<CurvePoint> points = cm->getCurve();
@@ -191,6 +312,7 @@ int main(int argc, char* argv[]) {
 	  cm->addPoint(p, p.curve_id, p.t);
 	}
       }
+      cm->setDeadline(deadline);
       cm->endCurve(-1);
       break;
     case 2:
@@ -206,7 +328,7 @@ int main(int argc, char* argv[]) {
 	  t.addPoint(p, p.curve_id, p.t);
 	}
       }
-      t.endCurve(-1);
+      t.endCurve(-1, deadline);
       qDebug("Waiting for thread ...");
       t.waitForIdle();
       qDebug("Thread is idle ...");
@@ -13,7 +13,7 @@ INCLUDEPATH += . ../curve
 LIBPATH += . ../curve/build
 
 SOURCES += cli.cpp
-HEADERS += ../curve/curve_match.h ../curve/tree.h ../curve/thread.h ../curve/incr_match.h ../curve/scenario.h ../curve/multi.h ../curve/config.h
+HEADERS += ../curve/curve_match.h ../curve/engine.h ../curve/batch.h ../curve/shortlist.h ../curve/trace.h ../curve/replay.h ../curve/tree.h ../curve/thread.h ../curve/event_queue.h ../curve/incr_match.h ../curve/scenario.h ../curve/multi.h ../curve/config.h
 
 DESTDIR = build
 OBJECTS_DIR = $$DESTDIR
@@ -0,0 +1,107 @@
+#include "batch.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+
+#include "curve_match.h"
+#ifdef INCREMENTAL
+#include "incr_match.h"
+#endif /* INCREMENTAL */
+
+// avoid compiler warning: deleting object of polymorphic class type 'XXX'
+// which has non-virtual destructor might cause undefined behaviour
+BatchCallBack::~BatchCallBack() {}
+
+BatchMatch::BatchMatch(QSharedPointer<MatchEngine> engine, BatchCallBack *callback, int threads) {
+  this -> engine = engine;
+  this -> callback = callback;
+  if (threads <= 0) { threads = QThread::idealThreadCount(); }
+  if (threads <= 0) { threads = 1; }
+  pool.setMaxThreadCount(threads);
+  done_count = 0;
+  queued = 0;
+  implem = 1;
+  deadline = 0;
+  defparam = false;
+  debug = false;
+}
+
+void BatchMatch::add(QString json) {
+  if (! queued) { timer.start(); }
+  pool.start(new BatchTask(this, queued ++, json));
+}
+
+void BatchMatch::add(ReplayFile *replay, int index) {
+  if (! queued) { timer.start(); }
+  pool.start(new BatchTask(this, queued ++, QString(), replay, index));
+}
+
+void BatchMatch::waitForDone() {
+  pool.waitForDone();
+}
+
+int BatchMatch::getCount() {
+  return done_count.loadAcquire();
+}
+
+float BatchMatch::getRate() {
+  /* throughput in gestures per second */
+  if (! queued) { return 0; }
+  qint64 elapsed = timer.elapsed();
+  return elapsed?(1000.0 * getCount() / elapsed):0;
+}
+
+void BatchMatch::matchOne(int index, QString json, ReplayFile *replay, int replay_index) {
+  /* run in worker thread: one session per gesture (this is cheap as the
+     word tree is held by the shared engine) */
+  QJsonObject obj;
+  int id;
+  if (replay) {
+    id = replay->getGesture(replay_index)->id;
+  } else {
+    obj = QJsonDocument::fromJson(json.toUtf8()).object();
+    if (obj.contains("input")) { obj = obj["input"].toObject(); }
+    id = obj.contains("id")?obj["id"].toInt():index;
+  }
+
+  CurveMatch *cm;
+#ifdef INCREMENTAL
+  if (implem == 1) {
+    cm = new IncrementalMatch(engine);
+  } else {
+    cm = new CurveMatch(engine);
+  }
+#else
+  cm = new CurveMatch(engine);
+#endif /* INCREMENTAL */
+
+  cm->setDebug(debug);
+  cm->clearCurve();
+  if (replay) {
+    cm->fromReplay(*replay, replay_index);
+  } else {
+    cm->fromJson(obj);
+  }
+  if (defparam) { cm->useDefaultParameters(); }
+  cm->getParamsPtr()->fallback_threads = 1; // sessions already run in parallel
+  cm->prepareIndex(true); // results must not depend on dictionary index build time
+
+  // same as cli: simulate points feeding (required by incremental algorithm)
+  QList<CurvePoint> points = cm->getCurve();
+  cm->clearCurve();
+  foreach(CurvePoint p, points) {
+    if (p.end_marker) {
+      cm->endOneCurve(p.curve_id);
+    } else {
+      cm->addPoint(p, p.curve_id, p.t);
+    }
+  }
+  cm->setDeadline(deadline);
+  cm->endCurve(id);
+
+  if (callback) { callback->result(index, id, cm->resultToString()); }
+
+  delete cm;
+  done_count.ref();
+}
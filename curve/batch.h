@@ -0,0 +1,70 @@
+/* batch matching: process a stream of gestures (JSON documents, as found in
+   logs or test files, or binary gesture files, cf. replay.h) with a thread pool. All sessions share the same
+   MatchEngine, so the word tree is loaded only once.
+   This is intended for offline processing (tests, parameters optimization...) */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <QString>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+#include "config.h"
+#include "engine.h"
+#include "replay.h"
+
+class BatchCallBack {
+ public:
+  virtual ~BatchCallBack();
+  virtual void result(int index, int id, QString json) = 0; // warning: called from worker threads
+};
+
+class BatchMatch {
+ private:
+  QSharedPointer<MatchEngine> engine;
+  BatchCallBack *callback;
+  QThreadPool pool;
+  QElapsedTimer timer;
+  QAtomicInt done_count;
+  int queued;
+
+  int implem;
+  int deadline;
+  bool defparam;
+  bool debug;
+
+ public:
+  BatchMatch(QSharedPointer<MatchEngine> engine, BatchCallBack *callback, int threads = 0);
+
+  void setImplementation(int implem) { this -> implem = implem; } // 0: simple, 1: incremental
+  void setDeadline(int deadline) { this -> deadline = deadline; }
+  void setDefaultParameters(bool value) { this -> defparam = value; }
+  void setDebug(bool debug) { this -> debug = debug; }
+
+  void add(QString json);
+  void add(ReplayFile *replay, int index); // replay file must stay open until waitForDone()
+  void waitForDone();
+
+  int getCount();
+  float getRate();
+
+  void matchOne(int index, QString json, ReplayFile *replay = NULL, int replay_index = 0);
+};
+
+class BatchTask : public QRunnable {
+ private:
+  BatchMatch *batch;
+  int index;
+  QString json;
+  ReplayFile *replay;
+  int replay_index;
+ public:
+  BatchTask(BatchMatch *batch, int index, QString json, ReplayFile *replay = NULL, int replay_index = 0) :
+    batch(batch), index(index), json(json), replay(replay), replay_index(replay_index) {};
+  void run() { batch->matchOne(index, json, replay, replay_index); }
+};
+
+#endif /* BATCH_H */
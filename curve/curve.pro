@@ -11,8 +11,8 @@ QT += qml quick widgets
 DEPENDPATH += .
 INCLUDEPATH += .
 
-SOURCES += curve_plugin.cpp curve_match.cpp multi.cpp scenario.cpp tree.cpp score.cpp functions.cpp kb_distort.cpp thread.cpp incr_match.cpp key_shift.cpp log.cpp
-HEADERS += curve_plugin.h curve_match.h multi.h scenario.h tree.h score.h functions.h log.h params.h kb_distort.h config.h incr_match.h thread.h key_shift.h
+SOURCES += curve_plugin.cpp curve_match.cpp multi.cpp scenario.cpp tree.cpp score.cpp functions.cpp kb_distort.cpp thread.cpp incr_match.cpp key_shift.cpp log.cpp event_queue.cpp engine.cpp batch.cpp shortlist.cpp trace.cpp replay.cpp
+HEADERS += curve_plugin.h curve_match.h multi.h scenario.h tree.h score.h functions.h log.h params.h kb_distort.h config.h incr_match.h thread.h key_shift.h event_queue.h engine.h batch.h shortlist.h trace.h replay.h
 
 DESTDIR = build
 OBJECTS_DIR = $$DESTDIR
@@ -16,6 +16,8 @@
 #include <sys/resource.h>
 
 #include "functions.h"
+#include "trace.h"
+#include "replay.h"
 
 #define PARAMS_IMPL
 #include "params.h"
@@ -49,15 +51,31 @@ void curve_smooth(QList<CurvePoint> &curve) {
 }
 
 /* --- main class for curve matching ---*/
-CurveMatch::CurveMatch() : keyShift(&params) {
-  loaded = false;
+CurveMatch::CurveMatch(QSharedPointer<MatchEngine> engine) : keyShift(&params) {
+  if (engine.isNull()) { engine = createEngine(); } // private engine
+  this -> engine = engine;
   params = default_params;
   debug = false;
   done = false;
+  deadline = 0;
   kb_preprocess = true;
   id = -1;
   screen_x = screen_y = 0;
   pixels_x = pixels_y = 0;
+  load_serial = engine -> getLoadStats().serial; // dictionary may be already loaded
+  cold_pending = false;
+  cold_keys = 0;
+}
+
+QSharedPointer<MatchEngine> CurveMatch::createEngine() {
+  return QSharedPointer<MatchEngine>(new MatchEngine());
+}
+
+bool CurveMatch::attachTree() {
+  /* get current word tree from engine (it will stay valid for the whole
+     gesture even if another session learns a new word in the meantime) */
+  wordtree = engine -> getTree();
+  return ! wordtree.isNull();
 }
 
 bool CurveMatch::curvePreprocess1(int curve_id) {
@@ -65,6 +83,7 @@ bool CurveMatch::curvePreprocess1(int curve_id) {
      - evaluate turn rate
      - find sharp turns
      - normal vector calculation */
+  PhaseTimer timer(st.st_t_preprocess);
 
   bool on_hold = false;
 
@@ -764,6 +783,7 @@ void CurveMatch::curvePreprocess2() {
      - average speed
      - check if curve looks like a straight line (used later in scoring)
    */
+  PhaseTimer timer(st.st_t_preprocess);
 
   /* special points count */
   st.st_special = 0;
@@ -811,6 +831,7 @@ void CurveMatch::curvePreprocess2() {
 
 void CurveMatch::setDebug(bool debug) {
   this -> debug = debug;
+  engine -> setDebug(debug);
 }
 void CurveMatch::clearKeys() {
   keys.clear();
@@ -971,6 +992,8 @@ void CurveMatch::addPoint(Point point, int curve_id, int timestamp) {
     // we must apply keyboard biases before feeding the curve
     // in case of incremental processing
     kb_preprocess = false;
+    QElapsedTimer timer;
+    timer.start();
     if (params.thumb_correction) {
       float kb_scaling_ratio = dpi_ratio * pow(size_ratio, params.scaling_kb_size_pow); // TODO temporary formula :-)
 
@@ -979,6 +1002,7 @@ void CurveMatch::addPoint(Point point, int curve_id, int timestamp) {
       kb_distort_cancel(keys);
     }
     keyShift.loadAndApply(keys);
+    if (cold_pending) { cold_keys += timer.nsecsElapsed() / 1000; }
 
     if (debug) {
       DBG("Keys adjustments:");
@@ -1056,37 +1080,26 @@ bool CurveMatch::loadTree(QString fileName) {
 
   keyShift.setDirectory(QFileInfo(fileName).path()); // by convention key-shift will use the same directory as .tre files
 
-  if (loaded && fileName == this -> treeFile) { return true; }
-  userDictionary.clear();
-
-  bool status = wordtree.loadFromFile(fileName);
-  loaded = status;
-  this -> treeFile = fileName;
+  bool status = engine -> loadTree(fileName, params);
+  load_stats_t ls = engine -> getLoadStats();
+  if (status && ls.serial != load_serial) {
+    // dictionary has actually been (re)loaded: next gesture pays for it
+    load_serial = ls.serial;
+    cold = ls;
+    cold_keys = 0;
+    cold_pending = true;
+  }
   if (fileName.isEmpty()) {
-    logdebug("loadtree(-): %d", status);
-    this -> userDictFile = QString();
-    loaded = false;
-
-  } else if (loaded) {
-    QString uf = fileName;
-    if (uf.endsWith(".tre")) { uf.remove(uf.length() - 4, 4); }
-    uf += "-user.txt";
-    this -> userDictFile = uf;
-    loadUserDict();
-    logdebug("loadTree(%s): %d", QSTRING2PCHAR(fileName), status);
+    // unloading: also release our own reference (and everything pointing into the tree)
+    scenarios.clear();
+    candidates.clear();
+    wordtree.clear();
   }
   return status;
 }
 
 void CurveMatch::log(QString txt) {
-  if (! logFile.isNull()) {
-    QFile file(logFile);
-    if (file.open(QIODevice::Append)) {
-      QTextStream out(&file);
-      out << txt << "\n";
-    }
-    file.close();
-  }
+  if (! logFile.isEmpty()) { log_data(txt.toUtf8()); } // written asynchronously (cf. log.cpp)
 }
 
 void CurveMatch::setLogFile(QString fileName) {
@@ -1114,6 +1127,7 @@ void CurveMatch::scenarioFilter(QList<ScenarioType> &scenarios, float score_rati
 
      This method is awfully inefficient, but as the target is to use only the incremental
      implementation (class IncrementalMatch), it'll stay as is */
+  PhaseTimer timer(st.st_t_filter);
 
   float max_score = 0;
 
@@ -1175,27 +1189,89 @@ void CurveMatch::scenarioFilter(QList<ScenarioType> &scenarios, float score_rati
 
 bool CurveMatch::setCurves() {
   bool result = false;
+
+  /* key pass index radius: no positive distance score is possible beyond this
+     distance (cf. Scenario::calc_distance_score, including anisotropy), for
+     any letter position (first, middle or last letter) */
+  float dist_max = max(params.dist_max_start, max(params.dist_max_next, params.dist_max_last));
+  float radius = dist_max * pow(params.glob_size_ratio, params.scaling_filtering_pow) * max(1.0f, params.anisotropy_ratio);
+  int pass_radius = (radius < 10000)?(1 + radius):10000; // also catches NaN & infinite values
+
   for (int i = 0; i < curve_count; i ++) {
     bool on_hold = curvePreprocess1(i);
     quickCurves[i].setCurve(curve, scaling_ratio, i, params.multi_dot_threshold);
     quickCurves[i].on_hold = on_hold;
+    if (params.key_pass) {
+      quickCurves[i].updateKeyPass(&quickKeys, pass_radius);
+    } else {
+      quickCurves[i].clearKeyPass();
+    }
 
     result |= on_hold;
   }
   quickCurves[curve_count].clearCurve();
+
+  st.st_mem_curve = 0;
+  if (params.mem_stats) {
+    for (int i = 0; i < curve_count; i ++) { st.st_mem_curve += quickCurves[i].getMemory(); }
+  }
   return result;
 }
 
+bool CurveMatch::dictionaryFilter(QSet<int> &nodes, bool use_shortlist) {
+  /* find tree nodes leading to words compatible with the gesture: words from
+     start key / end key / length buckets and/or template shortlist
+     this is only usable once the curve is complete, and only worth it with
+     large dictionaries */
+  bool use_bucket = (params.bucket_length_ratio > 0);
+  use_shortlist = use_shortlist && (params.shortlist_size > 0);
+  if (! (use_bucket || use_shortlist) || curve_count != 1) { return false; }
+
+  QSharedPointer<ShortlistIndex> index = engine -> getShortlist(wordtree, keys, params.shortlist_samples);
+  if (index.isNull() || index -> getCount() < params.shortlist_min_words) { return false; }
+
+  QVector<int> words;
+  if (use_bucket) {
+    index -> bucketWords(curve, params.dist_max_start * scaling_ratio, params.dist_max_next * scaling_ratio,
+			 params.bucket_length_ratio, words);
+    st.st_bucket = words.size();
+    if (! words.size()) { return false; } // something is wrong with this gesture, so let's not filter anything
+  }
+  if (use_shortlist) {
+    words = index -> query(curve, params.shortlist_size, use_bucket?&words:NULL);
+    st.st_shortlist = words.size();
+  }
+
+  index -> markNodes(wordtree.data(), words, nodes);
+  nodes.unite(engine -> getUserNodes(wordtree)); // learned words are not in the index
+  DBG("Dictionary filter: %d words, %d nodes (bucket: %d, index: %d words)", words.size(), nodes.size(), st.st_bucket, index -> getCount());
+  return true;
+}
+
+void CurveMatch::prepareIndex(bool wait) {
+  /* start building the dictionary index if the dictionary filter needs it
+     (it is built by a background thread, so it should be ready when the
+     gesture is complete). With wait set, wait until it is available (e.g.
+     for tests, so results do not depend on timing) */
+  if (params.bucket_length_ratio <= 0 && params.shortlist_size <= 0) { return; }
+  if (! attachTree() || ! keys.size()) { return; }
+  engine -> getShortlist(wordtree, keys, params.shortlist_samples, wait);
+}
+
 bool CurveMatch::match() {
   /* run the full "one-shot algorithm */
+  TraceScope trace("match");
   scenarios.clear();
   candidates.clear();
 
-  if (! loaded || ! keys.size() || ! curve.size()) { return false; }
+  if (! attachTree() || ! keys.size() || ! curve.size()) { return false; }
   if (curve.size() < 3) { return false; }
 
   memset(& st, 0, sizeof(st));
 
+  params.glob_mem = params.mem_stats?&mem:NULL;
+  mem.resetPeak();
+
   // change order for equal items: qSort(curve.begin(), curve.end()); // in multi mode we may lose point ordering
 
   quickKeys.setParams(&params);
@@ -1204,7 +1280,11 @@ bool CurveMatch::match() {
   setCurves();
   curvePreprocess2();
 
-  ScenarioType root = ScenarioType(&wordtree, &quickKeys, quickCurves, &params);
+#ifdef MULTI
+  ScenarioType root = ScenarioType(wordtree.data(), &quickKeys, quickCurves, &params, &multi_context);
+#else
+  ScenarioType root = ScenarioType(wordtree.data(), &quickKeys, quickCurves, &params);
+#endif /* MULTI */
   root.setDebug(debug);
   scenarios.append(root);
 
@@ -1212,6 +1292,10 @@ bool CurveMatch::match() {
   timer.start();
   double start_cpu_time = getCPUTime();
 
+  // only explore tree nodes leading to words compatible with the gesture (large dictionaries only)
+  QSet<int> filter_nodes;
+  bool use_filter = dictionaryFilter(filter_nodes, true);
+
   int count = 0;
 
   int n = 0;
@@ -1220,10 +1304,26 @@ bool CurveMatch::match() {
     foreach(ScenarioType scenario, scenarios) {
 
       QList<ScenarioType> childs;
-      scenario.nextKey(childs, st);
+      {
+	PhaseTimer timer(st.st_t_expand);
+	if (use_filter) {
+	  foreach(LetterNode child_node, scenario.getNextKeys()) {
+	    if (filter_nodes.contains(child_node.getIndex())) {
+	      scenario.childScenario(child_node, childs, st);
+	    }
+	  }
+	} else {
+	  scenario.nextKey(childs, st);
+	}
+      }
       foreach(ScenarioType child, childs) {
 	if (child.isFinished()) {
-	  if (child.postProcess(st)) {
+	  bool ok;
+	  {
+	    PhaseTimer timer(st.st_t_postprocess);
+	    ok = child.postProcess(st);
+	  }
+	  if (ok) {
 	    DBG("New candidate: %s (score=%.3f)", QSTRING2PCHAR(child.getId()), child.getScore());
 	    candidates.append(child);
 	  } else {
@@ -1266,14 +1366,48 @@ bool CurveMatch::match() {
 
   logdebug("Candidates: %d (time=%d, nodes=%d, forks=%d, skim=%d, speed=%d, special=%d, cputime=%d, treefile=%s)",
 	   candidates.size(), st.st_time, st.st_count, st.st_fork, st.st_skim, st.st_speed,
-	   st.st_special, st.st_cputime, QSTRING2PCHAR(treeFile));
+	   st.st_special, st.st_cputime, QSTRING2PCHAR(engine -> getTreeFile()));
+  updateMemStats();
+  updateLoadStats();
+  logPhaseTimes();
 
   done = true;
 
   return candidates.size() > 0;
 }
 
+void CurveMatch::updateMemStats() {
+  if (! params.mem_stats) { return; }
+  st.st_mem_live = mem.getBytes();
+  st.st_mem_peak = mem.getPeakBytes();
+  st.st_mem_scenario = mem.getPeakObjects(MEM_SCENARIO);
+  st.st_mem_multi = mem.getPeakObjects(MEM_MULTI);
+  st.st_mem_delayed = mem.getPeakObjects(MEM_DELAYED);
+  logdebug("Memory (bytes): live=%d, peak=%d, curve=%d, snapshot=%d - peak objects: scenario=%d, multi=%d, delayed=%d",
+	   st.st_mem_live, st.st_mem_peak, st.st_mem_curve, st.st_mem_snapshot,
+	   st.st_mem_scenario, st.st_mem_multi, st.st_mem_delayed);
+}
+
+void CurveMatch::updateLoadStats() {
+  /* first gesture after a dictionary (re)load: report what it had to wait for */
+  if (! cold_pending) { return; }
+  cold_pending = false;
+  st.st_cold = 1;
+  st.st_load_restored = cold.restored;
+  st.st_t_load_tree = cold.t_tree;
+  st.st_t_load_user = cold.t_userdict;
+  st.st_t_load_keys = cold_keys;
+  logdebug("Cold start (us): tree=%d, user dictionary=%d (%d words), keys=%d, restored=%d",
+	   st.st_t_load_tree, st.st_t_load_user, cold.userdict_words, st.st_t_load_keys, st.st_load_restored);
+}
+
+void CurveMatch::logPhaseTimes() {
+  logdebug("Phase times (us): preprocess=%d, expand=%d, filter=%d, fallback=%d, postprocess=%d, sort=%d",
+	   st.st_t_preprocess, st.st_t_expand, st.st_t_filter, st.st_t_fallback, st.st_t_postprocess, st.st_t_sort);
+}
+
 void CurveMatch::sortCandidates() {
+  PhaseTimer timer(st.st_t_sort);
   QList <ScenarioType *> pcandidates = QList<ScenarioType *>();
   QListIterator<ScenarioType> it(candidates);
   while(it.hasNext()) {
@@ -1291,9 +1425,10 @@ void CurveMatch::endCurve(int correlation_id) {
     }
   }
   this -> id = correlation_id;
-  log(QString("IN: ") + toString());
+  st.st_deadline = deadline; // only honored by incremental implementation
+  if (! logFile.isEmpty()) { log(QString("IN: ") + toString()); }
   if (! done) { match(); }
-  log(QString("OUT: ") + resultToString());
+  if (! logFile.isEmpty()) { log(QString("OUT: ") + resultToString()); }
 }
 
 void CurveMatch::setParameters(QString jsonStr) {
@@ -1340,7 +1475,7 @@ void CurveMatch::toJson(QJsonObject &json) {
   json["curve"] = json_curve;
 
   // other
-  json["treefile"] = treeFile;
+  json["treefile"] = engine -> getTreeFile();
   json["datetime"] = QDateTime::currentDateTime().toString(Qt::ISODate);
 
   // screen features
@@ -1399,6 +1534,45 @@ void CurveMatch::fromJson(const QJsonObject &json) {
   scaling_ratio = 0; /* we will recompute it */
 }
 
+void CurveMatch::fromReplay(ReplayFile &replay, int index) {
+  /* same as fromJson(), but data is read directly from a memory mapped file */
+  const replay_gesture_t *g = replay.getGesture(index);
+
+  params = replay.getParams(index);
+
+  const replay_key_t *rk = replay.getKeys(index);
+  keys.clear();
+  for(unsigned int i = 0; i < g->key_count; i ++) {
+    Key k(rk[i].x, rk[i].y, rk[i].width, rk[i].height, QString::fromUtf8(rk[i].label));
+    keys[k.label] = k;
+  }
+  scaling_ratio = 0;
+  computeScalingRatio();
+
+  const replay_point_t *rp = replay.getPoints(index);
+  curve.clear();
+  for(unsigned int i = 0; i < g->point_count; i ++) {
+    CurvePoint p(Point(), rp[i].curve_id, 0);
+    p.speed = 0; // as CurvePoint::fromJson()
+    if (rp[i].type & REPLAY_POINT_END_MARKER) {
+      p.end_marker = true;
+    } else {
+      p.x = rp[i].x;
+      p.y = rp[i].y;
+      p.t = rp[i].t;
+      p.flags = rp[i].flags;
+    }
+    curve.append(p);
+  }
+
+  dpi = g->dpi;
+  screen_x = g->screen_x;
+  screen_y = g->screen_y;
+  pixels_x = g->pixels_x;
+  pixels_y = g->pixels_y;
+  scaling_ratio = 0; /* we will recompute it */
+}
+
 void CurveMatch::fromString(const QString &jsonStr) {
   QJsonDocument doc = QJsonDocument::fromJson(jsonStr.toUtf8());
   fromJson(doc.object());
@@ -1440,6 +1614,39 @@ void CurveMatch::resultToJson(QJsonObject &json) {
   json_stats["speed"] = st.st_speed;
   json_stats["cache_hit"] = st.st_cache_hit;
   json_stats["cache_miss"] = st.st_cache_miss;
+  json_stats["cache_neg"] = st.st_cache_neg;
+  json_stats["cache_mem"] = st.st_cache_mem;
+  json_stats["spec_ok"] = st.st_spec_ok;
+  json_stats["spec_abort"] = st.st_spec_abort;
+  json_stats["deadline"] = st.st_deadline;
+  json_stats["truncated"] = st.st_truncated;
+  json_stats["early"] = st.st_early;
+  json_stats["early_ok"] = st.st_early_ok;
+  json_stats["beam_width"] = st.st_beam_width;
+  json_stats["beam_min"] = st.st_beam_min;
+  json_stats["beam_up"] = st.st_beam_up;
+  json_stats["beam_down"] = st.st_beam_down;
+  json_stats["shortlist"] = st.st_shortlist;
+  json_stats["bucket"] = st.st_bucket;
+  json_stats["bucket_cut"] = st.st_bucket_cut;
+  json_stats["t_preprocess"] = st.st_t_preprocess;
+  json_stats["t_expand"] = st.st_t_expand;
+  json_stats["t_filter"] = st.st_t_filter;
+  json_stats["t_fallback"] = st.st_t_fallback;
+  json_stats["t_postprocess"] = st.st_t_postprocess;
+  json_stats["t_sort"] = st.st_t_sort;
+  json_stats["mem_live"] = st.st_mem_live;
+  json_stats["mem_peak"] = st.st_mem_peak;
+  json_stats["mem_curve"] = st.st_mem_curve;
+  json_stats["mem_snapshot"] = st.st_mem_snapshot;
+  json_stats["mem_scenario"] = st.st_mem_scenario;
+  json_stats["mem_multi"] = st.st_mem_multi;
+  json_stats["mem_delayed"] = st.st_mem_delayed;
+  json_stats["cold"] = st.st_cold;
+  json_stats["load_restored"] = st.st_load_restored;
+  json_stats["t_load_tree"] = st.st_t_load_tree;
+  json_stats["t_load_user"] = st.st_t_load_user;
+  json_stats["t_load_keys"] = st.st_t_load_keys;
   json["stats"] = json_stats;
 
   QJsonObject json_params;
@@ -1463,201 +1670,23 @@ QString CurveMatch::resultToString(bool indent) {
 }
 
 void CurveMatch::learn(QString word, int addValue, bool init) {
-  QString letters = word2letter(word);
-
-  DBG("CM-learn [%s]: %s += %d (init:%d)", QSTRING2PCHAR(letters), QSTRING2PCHAR(word), addValue, (int) init);
-
-  if (letters.length() < 2 || word.length() < 2) { return; }
-  if (! params.user_dict_learn) { return; }
-  if (! loaded) { return; }
-
-  QString payload_word = word;
-  if (word == letters) {
-    payload_word = QString("=");
-  }
-
-  // get user dictionary
-  UserDictEntry entry;
-  if (userDictionary.contains(word)) {
-    entry = userDictionary[word];
-  }
-
-  // get data from in-memory tree
-  QPair<void*, int> pl = wordtree.getPayload(QSTRING2PUCHAR(letters));
-
-  // compute new node value for in-memory tree
-  QString payload;
-  bool found = false;
-  if (pl.first) { // existing node
-    payload = QString((const char*) pl.first);
-    QStringList lst = payload.split(",");
-    foreach(QString w, lst) {
-      if (w == payload_word) {
-	found = true; // we already know this word
-      }
-    }
-    if (found) {
-      payload = QString(); // don't update the tree
-    } else {
-      lst.append(payload_word);
-      payload = lst.join(",");
-    }
-  } else { // new node
-    payload = payload_word;
-  }
-
-  // do not learn new words if we already know them
-  if (init && found) {
-    // during initialization we try to add a word which is already in the tree
-    // (may be caused by issues with storage file or updated dictionary)
-    userDictionary.remove(word);
-    return;
-  }
-  if (! init && ! userDictionary.contains(word) && found) {
-    // during keyboard usage do not add known word unless they are already in user directory
-    return;
-  }
-
-  // update in-memory tree
-  int now = (int) time(0);
-  if (addValue >= 0 && ! payload.isEmpty()) {
-    if (! init) { logdebug("Learned new word: %s [%s]", QSTRING2PCHAR(word), QSTRING2PCHAR(letters)); }
-    unsigned char *ptr = QSTRING2PUCHAR(payload);
-    int len = strlen((char*) ptr) + 1;
-    unsigned char pl_char[len];
-    memmove(pl_char, ptr, len);
-    wordtree.setPayload(QSTRING2PUCHAR(letters), pl_char, len);
-    DBG("CM-learn: update tree %s -> '%s' payload=[%s]", QSTRING2PCHAR(letters), QSTRING2PCHAR(word), pl_char);
-  }
-
-  // update user directory
-  float new_count;
-  if (init) {
-    new_count = entry.count;
-  } else {
-    new_count = entry.getUpdatedCount(now, params.user_dict_halflife) + addValue;
-    if (new_count < 0) { new_count = 0; }
-
-    userdict_dirty = true;
-  }
-  userDictionary[word] = UserDictEntry(letters, now, new_count);
-
-  if (! init || debug) {
-    logdebug("Learn: %s (%s) (init: %d, add: %d) %.4f->%.4f",
-	     QSTRING2PCHAR(word), QSTRING2PCHAR(letters),
-	     init, addValue,
-	     entry.count, new_count);
-  }
-}
-
-void CurveMatch::loadUserDict() {
-  if (userDictFile.isEmpty()) { return; }
-
-  userdict_dirty = false;
-  userDictionary.clear();
-
-  QFile file(userDictFile);
-  if (! file.open(QIODevice::ReadOnly)) { return; }
-
-  QTextStream in(&file);
-
-  QString line;
-  do {
-    line = in.readLine();
-    QTextStream stream(&line);
-    QString word, letters;
-    float count;
-    int ts;
-
-    stream >> word >> letters >> count >> ts;
-
-    if (count && ts) {
-      userDictionary[word] = UserDictEntry(letters, ts, count);
-      learn(word, 0, true); // add the word to in memory tree dictionary
-    }
-  } while (!line.isNull());
-
-  file.close();
-  purgeUserDict();
+  engine -> learn(word, addValue, init, params);
 }
 
 void CurveMatch::saveUserDict() {
-  if (! userdict_dirty) { return; }
-  if (userDictFile.isEmpty()) { return; }
-  if (userDictionary.isEmpty()) { return; }
-
-  purgeUserDict();
-
-  QFile file(userDictFile + ".tmp");
-  if (! file.open(QIODevice::WriteOnly)) { return; }
-
-  QTextStream out(&file);
-
-  int now = (int) time(0);
-
-  QHashIterator<QString, UserDictEntry> i(userDictionary);
-  while (i.hasNext()) {
-    i.next();
-    UserDictEntry entry = i.value();
-    QString word = i.key();
-
-    float count = entry.getUpdatedCount(now, params.user_dict_halflife);
-
-    if (count > params.user_dict_min_count && ! word.isEmpty() && ! entry.letters.isEmpty()) {
-      out << word << " " << entry.letters << " " << entry.count << " " << entry.ts << endl;
-    }
-  }
-
-  file.close();
-  if (file.error()) { return; /* save failed */ }
-
-  // QT rename can't do an atomic file replacement
-  rename(QSTRING2PCHAR(userDictFile + ".tmp"), QSTRING2PCHAR(userDictFile));
-
-  userdict_dirty = false;
+  engine -> saveUserDict(params);
 }
 
-float UserDictEntry::getUpdatedCount(int now, int days) const {
-  if (! ts || ! count) { return 0; }
-  if (now < ts) { return count; }
-
-  return ((float) count) * exp(- (float) (now - ts) * log(2) / days / 86400);
-}
-
-static int userDictLessThan(QPair<QString, float> &e1, QPair<QString, float> &e2) {
-  return e1.second < e2.second;
-}
-
-
-void CurveMatch::purgeUserDict() {
-  if (userDictionary.size() <= params.user_dict_size) { return; }
-
-  int now = time(0);
-
-  userdict_dirty = true;
-
-  QList<QPair<QString, float> > lst;
-  QHashIterator<QString, UserDictEntry> i(userDictionary);
-  while (i.hasNext()) {
-    i.next();
-    float score = i.value().getUpdatedCount(now, params.user_dict_halflife);
-    lst.append(QPair<QString, float>(i.key(), score));
-  }
-
-  qSort(lst.begin(), lst.end(), userDictLessThan);
-
-  for(int i = 0; i < lst.size() - params.user_dict_size; i ++) {
-    userDictionary.remove(lst[i].first);
-    logdebug("Learn/purge: %s", QSTRING2PCHAR(lst[i].first));
-  }
+void CurveMatch::saveSnapshot(bool unload) {
+  engine -> saveSnapshot(params, unload);
 }
 
 void CurveMatch::dumpDict() {
-  wordtree.dump();
+  engine -> dumpDict();
 }
 
-char* CurveMatch::getPayload(unsigned char *letters) {
-  return (char*) wordtree.getPayload(letters).first;
+QString CurveMatch::getPayload(unsigned char *letters) {
+  return engine -> getPayload(letters);
 }
 
 void CurveMatch::loadKeyPos() {
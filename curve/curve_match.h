@@ -22,6 +22,7 @@
 #include "scenario.h"
 #include "multi.h"
 #include "key_shift.h"
+#include "engine.h"
 
 #ifdef MULTI
 typedef MultiScenario ScenarioType;
@@ -31,37 +32,29 @@ typedef Scenario ScenarioType;
 
 double getCPUTime();
 
-/* user dictionary entry */
-class UserDictEntry {
- public:
-  UserDictEntry() : letters(QString()), ts(0), count(0.0) {};
-  UserDictEntry(QString _l, int _t, float _c) : letters(_l), ts(_t), count(_c) { };
-
-  float getUpdatedCount(int now, int days) const;
+class ReplayFile;
 
-  QString letters;
-  int ts;
-  float count;
-};
-
-/* main processing for curve matching */
+/* main processing for curve matching
+   (this is a matching "session": shared data is held by the MatchEngine) */
 class CurveMatch {
  protected:
+  MemStats mem; // first member: must outlive all scenarios
   QList<ScenarioType> scenarios;
   QList<ScenarioType> candidates;
   QList<CurvePoint> curve;
   QHash<QString, Key> keys;
   Params params;
-  LetterTree wordtree;
-  bool userdict_dirty;
-  bool loaded;
-  QString treeFile;
-  QString userDictFile;
+  QSharedPointer<MatchEngine> engine;
+  QSharedPointer<LetterTree> wordtree; // tree used for current gesture
+#ifdef MULTI
+  MultiContext multi_context;
+#endif /* MULTI */
   QString logFile;
   QTime startTime;
   int id;
   bool debug;
   bool done;
+  int deadline; // time budget for final matching in ms (0 = unbounded)
   int curve_length;
   int curve_count;
 
@@ -73,7 +66,7 @@ class CurveMatch {
 
   bool straight;
 
-  QHash<QString, UserDictEntry> userDictionary;
+  bool attachTree();
 
   void scenarioFilter(QList<ScenarioType> &scenarios, float score_ratio, int min_size, int max_size = -1, bool finished = false);
   bool curvePreprocess1(int curve_id = 0);
@@ -85,6 +78,17 @@ class CurveMatch {
 
   bool setCurves();
 
+  bool dictionaryFilter(QSet<int> &nodes, bool use_shortlist);
+
+  void logPhaseTimes();
+  void updateMemStats();
+  void updateLoadStats();
+
+  load_stats_t cold; // dictionary load costs, reported with next gesture
+  int cold_keys; // key shift loading (us)
+  int load_serial;
+  bool cold_pending;
+
   KeyShift keyShift;
 
   QuickKeys quickKeys;
@@ -95,8 +99,10 @@ class CurveMatch {
   void computeScalingRatio();
 
  public:
-  CurveMatch();
+  CurveMatch(QSharedPointer<MatchEngine> engine = QSharedPointer<MatchEngine>());
   virtual ~CurveMatch() {};
+  static QSharedPointer<MatchEngine> createEngine();
+  QSharedPointer<MatchEngine> getEngine() { return engine; }
   bool loadTree(QString file);
   void clearKeys();
   void addKey(Key key);
@@ -114,6 +120,7 @@ class CurveMatch {
 
   void fromJson(const QJsonObject &json);
   void fromString(const QString &jsonStr);
+  void fromReplay(ReplayFile &replay, int index); // binary gesture container (cf. replay.h)
 
   void toJson(QJsonObject &json);
   QString toString(bool indent = false);
@@ -122,15 +129,15 @@ class CurveMatch {
   void setParameters(QString jsonStr);
   Params* getParamsPtr();
   void useDefaultParameters();
+  void prepareIndex(bool wait);
 
   void setDebug(bool debug);
 
   void learn(QString word, int addValue = 1, bool init = false);
-  void loadUserDict();
   void saveUserDict();
-  void purgeUserDict();
+  void saveSnapshot(bool unload = false); // unload: dictionary is about to be unloaded
   void dumpDict();
-  char* getPayload(unsigned char *letters);
+  QString getPayload(unsigned char *letters);
 
   void sortCandidates();
 
@@ -142,6 +149,11 @@ class CurveMatch {
   float getScalingRatio() { computeScalingRatio(); return scaling_ratio; }
   void setScreenInfo(int dpi, float screen_x, float screen_y);
   void setScreenSizePixels(int pixels_x, int pixels_y);
+
+  void setDeadline(int ms) { deadline = ms; }
+  int getDeadline() { return deadline; }
+  bool isTruncated() { return st.st_truncated > 0; }
+  stats_t getStats() { return st; }
 };
 
 #endif /* CURVE_MATCH_H */
@@ -16,8 +16,12 @@ using namespace std;
 #ifdef THREAD
 PluginCallBack::PluginCallBack(CurveKB *p) : plugin(p) {}
 
-void PluginCallBack::call(QList<ScenarioDto> l) {
-  plugin->sendSignal(l);
+void PluginCallBack::call(QList<ScenarioDto> l, int deadline, bool truncated) {
+  plugin->sendSignal(l, deadline, truncated);
+}
+
+void PluginCallBack::provisional(QList<ScenarioDto> l) {
+  plugin->sendProvisionalSignal(l);
 }
 #endif /* THREAD */
 
@@ -31,6 +35,8 @@ CurveKB::CurveKB(QObject *parent) : QObject(parent)
   QSizeF size = srn->physicalSize();
   curveMatch.setScreenInfo(dotsPerInch, (float) size.width(), (float) size.height());
 
+  log_setstderr(false); // nobody reads keyboard stderr: only log to file (cf. setLogFile)
+
 #ifdef THREAD
   callback = new PluginCallBack(this);
   thread.setCallBack(callback);
@@ -81,21 +87,23 @@ void CurveKB::endOneCurve(int curve_id) {
 #endif /* THREAD */
 }
 
-void CurveKB::endCurve(int correlation_id)
+void CurveKB::endCurve(int correlation_id, int deadline)
 {
 #ifdef THREAD
-  thread.endCurve(correlation_id);
+  thread.endCurve(correlation_id, deadline);
   WF_IDLE; // synchronous call, so we have to wait until completion
 #else
+  curveMatch.setDeadline(deadline);
   curveMatch.endCurve(correlation_id);
 #endif /* THREAD */
 }
 
-void CurveKB::endCurveAsync(int correlation_id)
+void CurveKB::endCurveAsync(int correlation_id, int deadline)
 {
 #ifdef THREAD
-  thread.endCurve(correlation_id);
+  thread.endCurve(correlation_id, deadline);
 #else
+  curveMatch.setDeadline(deadline);
   curveMatch.endCurve(correlation_id); // there will be no callback
 #endif /* THREAD */
 }
@@ -109,9 +117,14 @@ void CurveKB::resetCurve()
 #endif /* THREAD */
 }
 
-void CurveKB::sendSignal(QList<ScenarioDto> &candidates)
+void CurveKB::sendSignal(QList<ScenarioDto> &candidates, int deadline, bool truncated)
 {
-  emit matchingDone(scenarioList2QVariantList(candidates));
+  emit matchingDone(scenarioList2QVariantList(candidates), deadline, truncated);
+}
+
+void CurveKB::sendProvisionalSignal(QList<ScenarioDto> &candidates)
+{
+  emit provisionalMatch(scenarioList2QVariantList(candidates));
 }
 
 QVariantList CurveKB::scenarioList2QVariantList(QList<ScenarioDto> &candidates) {
@@ -165,6 +178,13 @@ void CurveKB::setLogFile(QString fileName)
   curveMatch.setLogFile(fileName);
 }
 
+void CurveKB::setLogLevel(int level, bool binary, bool to_stderr)
+{
+  log_setlevel(level);
+  log_setbinary(binary);
+  log_setstderr(to_stderr);
+}
+
 QString CurveKB::getResultJson()
 {
   WF_IDLE;
@@ -22,7 +22,8 @@ class PluginCallBack : public ThreadCallBack {
   CurveKB *plugin;
  public:
   PluginCallBack(CurveKB *plugin);
-  void call(QList<ScenarioDto>);
+  void call(QList<ScenarioDto>, int deadline, bool truncated);
+  void provisional(QList<ScenarioDto>);
 };
 #endif /* THREAD */
 
@@ -46,13 +47,14 @@ class CurveKB : public QObject {
     Q_INVOKABLE void startCurve();
     Q_INVOKABLE void addPoint(int x, int y, int curve_id);
     Q_INVOKABLE void endOneCurve(int curve_id);
-    Q_INVOKABLE void endCurve(int correlation_id);
-    Q_INVOKABLE void endCurveAsync(int correlation_id);
+    Q_INVOKABLE void endCurve(int correlation_id, int deadline = 0);
+    Q_INVOKABLE void endCurveAsync(int correlation_id, int deadline = 0);
     Q_INVOKABLE void resetCurve();
 
     Q_INVOKABLE void loadKeys(QVariantList list);
     Q_INVOKABLE bool loadTree(QString fileName);
     Q_INVOKABLE void setLogFile(QString fileName);
+    Q_INVOKABLE void setLogLevel(int level, bool binary = false, bool to_stderr = false);
     Q_INVOKABLE QString getResultJson();
     Q_INVOKABLE void setDebug(bool debug);
     Q_INVOKABLE void loadParameters(QString params);
@@ -64,14 +66,16 @@ class CurveKB : public QObject {
     Q_INVOKABLE double getScalingRatio();
     Q_INVOKABLE void setScreenSizePixels(int x, int y);
 
-    void sendSignal(QList<ScenarioDto> &candidates);
+    void sendSignal(QList<ScenarioDto> &candidates, int deadline = 0, bool truncated = false);
+    void sendProvisionalSignal(QList<ScenarioDto> &candidates);
 
  private:
     QObject m_keyboard;
     QVariantList scenarioList2QVariantList(QList<ScenarioDto> &candidates);
 
  signals:
-    void matchingDone(QVariantList candidates);
+    void matchingDone(QVariantList candidates, int deadline, bool truncated);
+    void provisionalMatch(QVariantList candidates);
     
 };
 
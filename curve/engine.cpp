@@ -0,0 +1,526 @@
+#include "engine.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QStringList>
+#include <QRunnable>
+#include <math.h>
+#include <time.h>
+#include <stdio.h> // for rename()
+
+#include "functions.h"
+#include "log.h"
+#include "trace.h"
+
+/* warm restore snapshot file (host byte order, this is only a local cache) */
+#define SNAPSHOT_MAGIC 0x574b424f // "OKBW"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_TREE_OFFSET 4096 // page aligned tree data
+
+typedef struct {
+  quint32 magic;
+  quint32 version;
+  qint64 tree_size, tree_mtime; // source files (snapshot is discarded if they change)
+  qint64 user_size, user_mtime; // -1 if there is no user dictionary file
+  qint32 user_dict_learn, user_dict_size; // parameters used when loading user dictionary
+  qint32 tree_length;
+  qint32 tree_used; // tree data size (including learned words)
+  qint64 tree_offset;
+  qint64 userdict_offset;
+  qint32 userdict_size;
+  qint32 reserved;
+} snapshot_header_t;
+
+static void snapshotSource(snapshot_header_t &header, QString treeFile, QString userDictFile) {
+  QFileInfo tf(treeFile);
+  QFileInfo uf(userDictFile);
+  header.tree_size = tf.size();
+  header.tree_mtime = tf.lastModified().toMSecsSinceEpoch();
+  header.user_size = uf.exists()?uf.size():-1;
+  header.user_mtime = uf.exists()?uf.lastModified().toMSecsSinceEpoch():-1;
+}
+
+MatchEngine::MatchEngine() {
+  userdict_dirty = false;
+  snapshot_clean = false;
+  learned = false;
+  tree_shared = false;
+  shortlist_building = false;
+  shortlist_pool.setMaxThreadCount(1);
+  memset(&load_stats, 0, sizeof(load_stats));
+  debug = false;
+}
+
+bool MatchEngine::loadTree(QString fileName, const Params &params) {
+  /* load a .tre (word tree) file */
+  QMutexLocker locker(&mutex);
+
+  if (! tree.isNull() && fileName == this -> treeFile) { return true; }
+  userDictionary.clear();
+  userdict_dirty = false;
+  snapshot_clean = false;
+  learned = false;
+
+  tree.clear(); // sessions still using the previous tree keep their own reference
+  this -> treeFile = fileName;
+  this -> userDictFile = QString();
+  this -> snapshotFile = QString();
+
+  if (fileName.isEmpty()) {
+    logdebug("loadtree(-): 1");
+    return true;
+  }
+
+  TraceScope trace("loadTree");
+  QElapsedTimer timer;
+  timer.start();
+  load_stats.serial ++;
+  load_stats.t_tree = load_stats.t_userdict = load_stats.userdict_words = 0;
+  load_stats.restored = false;
+
+  QString base = fileName;
+  if (base.endsWith(".tre")) { base.remove(base.length() - 4, 4); }
+  this -> userDictFile = base + "-user.txt";
+  this -> snapshotFile = base + "-warm.snap";
+
+  QSharedPointer<LetterTree> new_tree(new LetterTree());
+  bool status = true;
+  if (params.warm_restore && restoreSnapshot(new_tree, params)) {
+    load_stats.restored = true;
+    load_stats.t_tree = timer.nsecsElapsed() / 1000;
+  } else {
+    status = new_tree -> loadFromFile(fileName);
+    load_stats.t_tree = timer.nsecsElapsed() / 1000;
+    if (status) {
+      TraceScope trace("loadUserDict");
+      loadUserDict(new_tree, params); // tree is not published yet, so no need to copy it
+      load_stats.t_userdict = timer.nsecsElapsed() / 1000 - load_stats.t_tree;
+    }
+  }
+
+  if (status) {
+    tree = new_tree;
+    tree_shared = false;
+    load_stats.userdict_words = userDictionary.size();
+  } else {
+    userDictFile = snapshotFile = QString();
+  }
+  logdebug("loadTree(%s): %d (tree: %dus, user dictionary: %d words in %dus, restored: %d)",
+	   QSTRING2PCHAR(fileName), status, load_stats.t_tree,
+	   load_stats.userdict_words, load_stats.t_userdict, load_stats.restored);
+  return status;
+}
+
+load_stats_t MatchEngine::getLoadStats() {
+  QMutexLocker locker(&mutex);
+  return load_stats;
+}
+
+bool MatchEngine::restoreSnapshot(QSharedPointer<LetterTree> &tree, const Params &params) {
+  /* map tree and load user dictionary from warm snapshot
+     returns false if there is no up to date snapshot (normal load is needed) */
+  QFile file(snapshotFile);
+  if (! file.open(QFile::ReadOnly)) { return false; }
+
+  snapshot_header_t header;
+  if (file.read((char*) &header, sizeof(header)) != sizeof(header) ||
+      header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION) {
+    logdebug("Bad warm snapshot file: %s", QSTRING2PCHAR(snapshotFile));
+    return false;
+  }
+
+  snapshot_header_t current;
+  snapshotSource(current, treeFile, userDictFile);
+  if (header.tree_size != current.tree_size || header.tree_mtime != current.tree_mtime ||
+      header.user_size != current.user_size || header.user_mtime != current.user_mtime ||
+      header.user_dict_learn != params.user_dict_learn || header.user_dict_size != params.user_dict_size) {
+    logdebug("Warm snapshot is out of date: %s", QSTRING2PCHAR(snapshotFile));
+    return false;
+  }
+
+  if (! file.seek(header.userdict_offset)) { return false; }
+  QByteArray block = file.read(header.userdict_size);
+  file.close();
+  if (block.size() != header.userdict_size) { return false; }
+
+  QHash<QString, UserDictEntry> entries;
+  QDataStream in(block);
+  qint32 count = 0;
+  in >> count;
+  for(int i = 0; i < count; i ++) {
+    QString word, letters;
+    qint32 ts;
+    float value;
+    in >> word >> letters >> ts >> value;
+    entries[word] = UserDictEntry(letters, ts, value);
+  }
+  if (in.status() != QDataStream::Ok) { return false; }
+
+  if (! tree -> mapFromFile(snapshotFile, header.tree_offset, header.tree_length, header.tree_used)) { return false; }
+
+  userDictionary = entries;
+  snapshot_clean = true;
+  return true;
+}
+
+void MatchEngine::saveSnapshot(const Params &params, bool unload) {
+  /* save prepared dictionary for warm restore: this must be called after
+     saveUserDict(), so the snapshot is tied to the current user dictionary file */
+  QMutexLocker locker(&mutex);
+
+  if (! params.warm_restore || snapshot_clean) { return; }
+  if (! unload && ! learned) { return; } // nothing new to keep (read-only run)
+  if (tree.isNull() || snapshotFile.isEmpty()) { return; }
+
+  TraceScope trace("saveSnapshot");
+  QElapsedTimer timer;
+  timer.start();
+
+  QByteArray block;
+  QDataStream out(&block, QIODevice::WriteOnly);
+  out << (qint32) userDictionary.size();
+  QHashIterator<QString, UserDictEntry> i(userDictionary);
+  while (i.hasNext()) {
+    i.next();
+    out << i.key() << i.value().letters << (qint32) i.value().ts << i.value().count;
+  }
+
+  snapshot_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = SNAPSHOT_MAGIC;
+  header.version = SNAPSHOT_VERSION;
+  snapshotSource(header, treeFile, userDictFile);
+  header.user_dict_learn = params.user_dict_learn;
+  header.user_dict_size = params.user_dict_size;
+  header.tree_length = tree -> getLength();
+  header.tree_used = tree -> getUsedSize();
+  header.tree_offset = SNAPSHOT_TREE_OFFSET;
+  header.userdict_offset = header.tree_offset + header.tree_used;
+  header.userdict_size = block.size();
+
+  QSaveFile file(snapshotFile); // atomic replacement
+  if (! file.open(QIODevice::WriteOnly)) {
+    logdebug("Can not write warm snapshot: %s", QSTRING2PCHAR(snapshotFile));
+    return;
+  }
+  file.write((const char*) &header, sizeof(header));
+  file.write(QByteArray((int) (SNAPSHOT_TREE_OFFSET - sizeof(header)), 0));
+  file.write((const char*) tree -> getData(), header.tree_used);
+  file.write(block);
+  if (! file.commit()) {
+    logdebug("Can not write warm snapshot: %s", QSTRING2PCHAR(snapshotFile));
+    return;
+  }
+
+  snapshot_clean = true;
+  logdebug("Warm snapshot saved: %s (%d bytes, %d user words) in %dms", QSTRING2PCHAR(snapshotFile),
+	   (int) (header.userdict_offset + header.userdict_size), userDictionary.size(), (int) timer.elapsed());
+}
+
+QSharedPointer<LetterTree> MatchEngine::getTree() {
+  QMutexLocker locker(&mutex);
+  tree_shared = true;
+  return tree;
+}
+
+QString MatchEngine::getTreeFile() {
+  QMutexLocker locker(&mutex);
+  return treeFile;
+}
+
+class ShortlistBuilder : public QRunnable {
+ private:
+  MatchEngine *engine;
+  QSharedPointer<LetterTree> tree;
+  QString file;
+  QHash<QString, Key> keys;
+  int samples;
+ public:
+  ShortlistBuilder(MatchEngine *engine, QSharedPointer<LetterTree> tree, QString file, QHash<QString, Key> keys, int samples) :
+    engine(engine), tree(tree), file(file), keys(keys), samples(samples) {};
+  void run() { engine -> buildShortlist(tree, file, keys, samples); }
+};
+
+QSharedPointer<ShortlistIndex> MatchEngine::getShortlist(QSharedPointer<LetterTree> tree, QHash<QString, Key> &keys, int samples, bool wait) {
+  /* dictionary index (template shortlist & buckets) is shared by all sessions
+     it is built by a background thread on first use, and rebuilt if the
+     dictionary file or keyboard layout changes. Until it is ready, this
+     returns a null pointer (i.e. no filtering), unless wait is set */
+  QString file = getTreeFile();
+  QString layout = ShortlistIndex::layoutSignature(keys);
+
+  QMutexLocker locker(&shortlist_mutex);
+  if (! shortlist.isNull() && shortlist -> isValid(file, layout, samples)) { return shortlist; }
+  if (tree.isNull()) { return QSharedPointer<ShortlistIndex>(); }
+
+  if (wait) {
+    locker.unlock();
+    shortlist_pool.waitForDone(); // a build may be in progress
+    locker.relock();
+    if (! shortlist.isNull() && shortlist -> isValid(file, layout, samples)) { return shortlist; }
+    locker.unlock();
+    buildShortlist(tree, file, keys, samples);
+    locker.relock();
+    return shortlist;
+  }
+
+  if (! shortlist_building) {
+    shortlist_building = true;
+    shortlist_pool.start(new ShortlistBuilder(this, tree, file, keys, samples));
+  }
+  return QSharedPointer<ShortlistIndex>();
+}
+
+void MatchEngine::buildShortlist(QSharedPointer<LetterTree> tree, QString file, QHash<QString, Key> keys, int samples) {
+  TraceScope trace("buildShortlist");
+  QSharedPointer<ShortlistIndex> new_shortlist(new ShortlistIndex(tree.data(), file, keys, samples));
+
+  QMutexLocker locker(&shortlist_mutex);
+  shortlist = new_shortlist;
+  shortlist_building = false;
+}
+
+QSet<int> MatchEngine::getUserNodes(QSharedPointer<LetterTree> tree) {
+  /* tree nodes leading to user dictionary words: they may have been learned
+     after the dictionary index was built, so the dictionary filter must
+     always let them through. This is computed once per tree version */
+  QMutexLocker locker(&mutex);
+  if (tree.isNull()) { return QSet<int>(); }
+  if (user_nodes_tree.toStrongRef() != tree) {
+    user_nodes.clear();
+    QHashIterator<QString, UserDictEntry> i(userDictionary);
+    while (i.hasNext()) {
+      i.next();
+      QByteArray letters = i.value().letters.toUtf8();
+      ShortlistIndex::markLetters(tree.data(), letters.constData(), user_nodes);
+    }
+    user_nodes_tree = tree;
+  }
+  return user_nodes; // implicitly shared
+}
+
+void MatchEngine::learn(QString word, int addValue, bool init, const Params &params) {
+  QMutexLocker locker(&mutex);
+  snapshot_clean = false;
+  learned = true;
+  learnInternal(tree, word, addValue, init, params, true);
+}
+
+void MatchEngine::learnInternal(QSharedPointer<LetterTree> &tree, QString word, int addValue, bool init, const Params &params, bool cow) {
+  QString letters = word2letter(word);
+
+  DBG("CM-learn [%s]: %s += %d (init:%d)", QSTRING2PCHAR(letters), QSTRING2PCHAR(word), addValue, (int) init);
+
+  if (letters.length() < 2 || word.length() < 2) { return; }
+  if (! params.user_dict_learn) { return; }
+  if (tree.isNull()) { return; }
+
+  QString payload_word = word;
+  if (word == letters) {
+    payload_word = QString("=");
+  }
+
+  // get user dictionary
+  UserDictEntry entry;
+  if (userDictionary.contains(word)) {
+    entry = userDictionary[word];
+  }
+
+  // get data from in-memory tree
+  QPair<void*, int> pl = tree -> getPayload(QSTRING2PUCHAR(letters));
+
+  // compute new node value for in-memory tree
+  QString payload;
+  bool found = false;
+  if (pl.first) { // existing node
+    payload = QString((const char*) pl.first);
+    QStringList lst = payload.split(",");
+    foreach(QString w, lst) {
+      if (w == payload_word) {
+	found = true; // we already know this word
+      }
+    }
+    if (found) {
+      payload = QString(); // don't update the tree
+    } else {
+      lst.append(payload_word);
+      payload = lst.join(",");
+    }
+  } else { // new node
+    payload = payload_word;
+  }
+
+  // do not learn new words if we already know them
+  if (init && found) {
+    // during initialization we try to add a word which is already in the tree
+    // (may be caused by issues with storage file or updated dictionary)
+    userDictionary.remove(word);
+    return;
+  }
+  if (! init && ! userDictionary.contains(word) && found) {
+    // during keyboard usage do not add known word unless they are already in user directory
+    return;
+  }
+
+  // update in-memory tree
+  int now = (int) time(0);
+  if (addValue >= 0 && ! payload.isEmpty()) {
+    if (! init) { logdebug("Learned new word: %s [%s]", QSTRING2PCHAR(word), QSTRING2PCHAR(letters)); }
+    unsigned char *ptr = QSTRING2PUCHAR(payload);
+    int len = strlen((char*) ptr) + 1;
+    unsigned char pl_char[len];
+    memmove(pl_char, ptr, len);
+    if (cow && tree_shared) {
+      // sessions may be matching with current tree: update a copy and publish it
+      // (next words are learned in place until a session gets the new tree)
+      tree = QSharedPointer<LetterTree>(new LetterTree(*(tree.data())));
+      tree_shared = false;
+    }
+    tree -> setPayload(QSTRING2PUCHAR(letters), pl_char, len);
+    DBG("CM-learn: update tree %s -> '%s' payload=[%s]", QSTRING2PCHAR(letters), QSTRING2PCHAR(word), pl_char);
+  }
+
+  // update user directory
+  float new_count;
+  if (init) {
+    new_count = entry.count;
+  } else {
+    new_count = entry.getUpdatedCount(now, params.user_dict_halflife) + addValue;
+    if (new_count < 0) { new_count = 0; }
+
+    userdict_dirty = true;
+  }
+  userDictionary[word] = UserDictEntry(letters, now, new_count);
+  user_nodes_tree.clear(); // tree may have been updated in place
+
+  if (! init || debug) {
+    logdebug("Learn: %s (%s) (init: %d, add: %d) %.4f->%.4f",
+	     QSTRING2PCHAR(word), QSTRING2PCHAR(letters),
+	     init, addValue,
+	     entry.count, new_count);
+  }
+}
+
+void MatchEngine::loadUserDict(QSharedPointer<LetterTree> &tree, const Params &params) {
+  if (userDictFile.isEmpty()) { return; }
+
+  userdict_dirty = false;
+  userDictionary.clear();
+
+  QFile file(userDictFile);
+  if (! file.open(QIODevice::ReadOnly)) { return; }
+
+  QTextStream in(&file);
+
+  QString line;
+  do {
+    line = in.readLine();
+    QTextStream stream(&line);
+    QString word, letters;
+    float count;
+    int ts;
+
+    stream >> word >> letters >> count >> ts;
+
+    if (count && ts) {
+      userDictionary[word] = UserDictEntry(letters, ts, count);
+      learnInternal(tree, word, 0, true, params, false); // add the word to in memory tree dictionary
+    }
+  } while (!line.isNull());
+
+  file.close();
+  purgeUserDict(params);
+}
+
+void MatchEngine::saveUserDict(const Params &params) {
+  QMutexLocker locker(&mutex);
+
+  if (! userdict_dirty) { return; }
+  if (userDictFile.isEmpty()) { return; }
+  if (userDictionary.isEmpty()) { return; }
+
+  purgeUserDict(params);
+
+  QFile file(userDictFile + ".tmp");
+  if (! file.open(QIODevice::WriteOnly)) { return; }
+
+  QTextStream out(&file);
+
+  int now = (int) time(0);
+
+  QHashIterator<QString, UserDictEntry> i(userDictionary);
+  while (i.hasNext()) {
+    i.next();
+    UserDictEntry entry = i.value();
+    QString word = i.key();
+
+    float count = entry.getUpdatedCount(now, params.user_dict_halflife);
+
+    if (count > params.user_dict_min_count && ! word.isEmpty() && ! entry.letters.isEmpty()) {
+      out << word << " " << entry.letters << " " << entry.count << " " << entry.ts << endl;
+    }
+  }
+
+  file.close();
+  if (file.error()) { return; /* save failed */ }
+
+  // QT rename can't do an atomic file replacement
+  rename(QSTRING2PCHAR(userDictFile + ".tmp"), QSTRING2PCHAR(userDictFile));
+
+  userdict_dirty = false;
+}
+
+float UserDictEntry::getUpdatedCount(int now, int days) const {
+  if (! ts || ! count) { return 0; }
+  if (now < ts) { return count; }
+
+  return ((float) count) * exp(- (float) (now - ts) * log(2) / days / 86400);
+}
+
+static int userDictLessThan(QPair<QString, float> &e1, QPair<QString, float> &e2) {
+  return e1.second < e2.second;
+}
+
+
+void MatchEngine::purgeUserDict(const Params &params) {
+  if (userDictionary.size() <= params.user_dict_size) { return; }
+
+  int now = time(0);
+
+  userdict_dirty = true;
+
+  QList<QPair<QString, float> > lst;
+  QHashIterator<QString, UserDictEntry> i(userDictionary);
+  while (i.hasNext()) {
+    i.next();
+    float score = i.value().getUpdatedCount(now, params.user_dict_halflife);
+    lst.append(QPair<QString, float>(i.key(), score));
+  }
+
+  qSort(lst.begin(), lst.end(), userDictLessThan);
+
+  for(int i = 0; i < lst.size() - params.user_dict_size; i ++) {
+    userDictionary.remove(lst[i].first);
+    logdebug("Learn/purge: %s", QSTRING2PCHAR(lst[i].first));
+  }
+}
+
+void MatchEngine::dumpDict() {
+  QSharedPointer<LetterTree> t = getTree();
+  if (t.isNull()) { return; }
+  t -> dump();
+}
+
+QString MatchEngine::getPayload(unsigned char *letters) {
+  /* payload is copied while we still hold a reference to the tree
+     (a concurrent learn may publish a new tree and release this one) */
+  QSharedPointer<LetterTree> t = getTree();
+  if (t.isNull()) { return QString(); }
+  char *payload = (char*) t -> getPayload(letters).first;
+  return payload?QString(payload):QString();
+}
@@ -0,0 +1,114 @@
+/* shared matching engine: this holds everything that does not depend on
+   the gesture being matched (word tree, user dictionary and dictionary
+   index). Parameters and key layout stay per session: they come with each
+   gesture (test cases, replays) or keyboard layout change (plugin).
+   It is shared (via QSharedPointer) between any number of matching sessions
+   (CurveMatch / IncrementalMatch instances), possibly running in different threads.
+
+   Sessions grab a reference to the current word tree when they start
+   matching a gesture, and then use it without any lock.
+   Learning a new word never modifies a tree in use: it updates a private
+   copy which is then published for next gestures (copy-on-write). The
+   copy is only made once the tree has been handed out, so a burst of
+   learned words costs a single copy
+
+   Warm restore: when the dictionary is unloaded (cf. auto-unload in
+   CurveThread), the prepared in-memory state (tree with user words applied
+   and user dictionary) can be saved as a snapshot file. Next load maps the
+   snapshot instead of reading the tree and replaying the whole user
+   dictionary, as long as source files have not changed.
+   Otherwise (e.g. thread exit) a snapshot is only written if words have
+   been learned, so read-only runs (tools, test suite) never write one.
+   Key layout and its adjustments (thumb correction, key shift) are not part
+   of the snapshot: they depend on the session (layout, screen scaling) and
+   are prepared again with the first gesture */
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <QString>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QWeakPointer>
+#include <QSet>
+#include <QThreadPool>
+
+#include "tree.h"
+#include "params.h"
+#include "scenario.h"
+#include "shortlist.h"
+
+/* user dictionary entry */
+class UserDictEntry {
+ public:
+  UserDictEntry() : letters(QString()), ts(0), count(0.0) {};
+  UserDictEntry(QString _l, int _t, float _c) : letters(_l), ts(_t), count(_c) { };
+
+  float getUpdatedCount(int now, int days) const;
+
+  QString letters;
+  int ts;
+  float count;
+};
+
+/* dictionary load statistics (first gesture penalty after a (re)load) */
+typedef struct {
+  int serial; // incremented for each actual load
+  int t_tree; // tree loading or snapshot mapping (us)
+  int t_userdict; // user dictionary loading (us)
+  int userdict_words;
+  bool restored; // loaded from warm snapshot
+} load_stats_t;
+
+class MatchEngine {
+ private:
+  QMutex mutex; // protects tree pointer exchange & user dictionary (never held while matching)
+  QSharedPointer<LetterTree> tree;
+  QString treeFile;
+  QString userDictFile;
+  QString snapshotFile;
+  bool snapshot_clean; // snapshot file matches in-memory state
+  bool learned; // words have been learned since last load
+  bool tree_shared; // current tree has been handed out to sessions (learning must copy it)
+  load_stats_t load_stats;
+  QHash<QString, UserDictEntry> userDictionary;
+  bool userdict_dirty;
+  bool debug;
+
+  QMutex shortlist_mutex; // protects index pointer exchange (index is built without lock)
+  QSharedPointer<ShortlistIndex> shortlist;
+  bool shortlist_building;
+
+  QSet<int> user_nodes; // tree nodes leading to user dictionary words
+  QWeakPointer<LetterTree> user_nodes_tree; // tree version user_nodes is valid for
+
+  void learnInternal(QSharedPointer<LetterTree> &tree, QString word, int addValue, bool init, const Params &params, bool cow);
+  void loadUserDict(QSharedPointer<LetterTree> &tree, const Params &params);
+  void purgeUserDict(const Params &params);
+  bool restoreSnapshot(QSharedPointer<LetterTree> &tree, const Params &params);
+
+ public:
+  MatchEngine();
+
+  bool loadTree(QString fileName, const Params &params);
+  QSharedPointer<LetterTree> getTree();
+  QString getTreeFile();
+
+  void learn(QString word, int addValue, bool init, const Params &params);
+  void saveUserDict(const Params &params);
+  void saveSnapshot(const Params &params, bool unload);
+  load_stats_t getLoadStats();
+  void dumpDict();
+  QString getPayload(unsigned char *letters);
+  QSharedPointer<ShortlistIndex> getShortlist(QSharedPointer<LetterTree> tree, QHash<QString, Key> &keys, int samples, bool wait = false);
+  void buildShortlist(QSharedPointer<LetterTree> tree, QString file, QHash<QString, Key> keys, int samples);
+  QSet<int> getUserNodes(QSharedPointer<LetterTree> tree);
+
+  void setDebug(bool debug) { this -> debug = debug; }
+
+ private:
+  QThreadPool shortlist_pool; // index builder thread (last member: it is waited for before anything else is destroyed)
+};
+
+#endif /* ENGINE_H */
@@ -0,0 +1,80 @@
+#include "event_queue.h"
+
+#ifdef THREAD
+
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "log.h"
+
+#define EVENT_QUEUE_MASK (EVENT_QUEUE_SIZE - 1)
+
+EventQueue::EventQueue() {
+  head = 0;
+  tail = 0;
+  sleeping = 0;
+  efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (efd < 0) { logdebug("eventfd() failed: falling back to polling"); }
+}
+
+EventQueue::~EventQueue() {
+  if (efd >= 0) { close(efd); }
+}
+
+bool EventQueue::push(const ThreadEvent &event) {
+  int h = head.load();
+  if (h - tail.loadAcquire() >= EVENT_QUEUE_SIZE) { return false; } // full
+
+  ring[h & EVENT_QUEUE_MASK] = event;
+  head.storeRelease(h + 1); // publish event
+
+  // full barrier: either the consumer sees the new head, or we see its sleeping flag
+  if (sleeping.fetchAndStoreOrdered(0) && efd >= 0) {
+    uint64_t one = 1;
+    if (write(efd, &one, sizeof(one)) < 0) { /* counter can not overflow here */ }
+  }
+  return true;
+}
+
+bool EventQueue::pop(ThreadEvent &event) {
+  int t = tail.load();
+  if (t == head.loadAcquire()) { return false; } // empty
+
+  ThreadEvent &slot = ring[t & EVENT_QUEUE_MASK];
+  event = slot;
+  slot.text = QString(); // don't keep strings alive until the slot is reused
+  tail.storeRelease(t + 1);
+  return true;
+}
+
+bool EventQueue::isEmpty() {
+  return tail.load() == head.loadAcquire();
+}
+
+bool EventQueue::wait(int timeout_ms) {
+  sleeping.fetchAndStoreOrdered(1);
+  if (! isEmpty()) {
+    sleeping.storeRelease(0);
+    return true;
+  }
+
+  struct pollfd pfd;
+  pfd.fd = efd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  if (efd >= 0) {
+    poll(&pfd, 1, timeout_ms);
+    uint64_t count;
+    if (read(efd, &count, sizeof(count)) < 0) { /* nothing to read on timeout */ }
+  } else {
+    usleep(10000); // no eventfd, plain polling
+  }
+
+  sleeping.storeRelease(0);
+  return ! isEmpty();
+}
+
+#endif /* THREAD */
@@ -0,0 +1,62 @@
+/* bounded single-producer / single-consumer event queue between the UI thread
+   (producer) and the matcher thread (consumer)
+
+   - producer never blocks: push() fails if the queue is full
+   - consumer sleeps on an eventfd, and it is only signaled when the consumer
+     has announced it is going to sleep (so in the common case adding a point
+     costs no system call at all) */
+
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include "config.h"
+
+#ifdef THREAD
+
+#include <QAtomicInt>
+#include <QString>
+#include <QElapsedTimer>
+
+#include "scenario.h"
+
+#define EVENT_QUEUE_SIZE 2048 // must be a power of 2
+
+enum thread_event_t {
+  EVT_POINT, EVT_END_ONE_CURVE, EVT_END, EVT_CLEAR, EVT_LOAD_TRE, EVT_LEARN, EVT_QUIT
+};
+
+class ThreadEvent {
+ public:
+  thread_event_t type;
+  CurvePoint point; // EVT_POINT
+  int value; // curve id (EVT_END_ONE_CURVE, EVT_END) or learn value (EVT_LEARN)
+  QString text; // file name (EVT_LOAD_TRE) or word (EVT_LEARN)
+  int deadline; // time budget in ms for matching (EVT_END)
+  QElapsedTimer posted; // deadline origin: started when the client posts EVT_END
+
+  ThreadEvent() : type(EVT_CLEAR), point(Point(), -1, 0), value(0), deadline(0) {};
+  ThreadEvent(thread_event_t type, int value = 0, QString text = QString()) : type(type), point(Point(), -1, 0), value(value), text(text), deadline(0) {};
+  ThreadEvent(CurvePoint point) : type(EVT_POINT), point(point), value(0), deadline(0) {};
+};
+
+class EventQueue {
+ private:
+  ThreadEvent ring[EVENT_QUEUE_SIZE];
+  QAtomicInt head; // next slot to write (only modified by producer)
+  QAtomicInt tail; // next slot to read (only modified by consumer)
+  QAtomicInt sleeping; // consumer is (or is about to be) waiting on the eventfd
+  int efd;
+
+ public:
+  EventQueue();
+  ~EventQueue();
+
+  bool push(const ThreadEvent &event); // producer side
+  bool pop(ThreadEvent &event); // consumer side
+  bool isEmpty();
+  bool wait(int timeout_ms = -1); // consumer side, returns false on timeout
+};
+
+#endif /* THREAD */
+
+#endif /* EVENT_QUEUE_H */
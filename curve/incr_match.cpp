@@ -4,24 +4,33 @@
 
 #include <iostream>
 #include <cstdlib>
+#include <algorithm>
+
+#include <QThread>
+#include <QMutexLocker>
 
 #include "functions.h"
+#include "trace.h"
 
 #define SC_METHOD(method, ...) (multi?(multi_p.data()->method(__VA_ARGS__)):(single_p.data()->method(__VA_ARGS__)))
 #define SC_PROP(prop) (multi?(multi_p.data()->prop):(single_p.data()->prop))
 
-DelayedScenario::DelayedScenario(LetterTree *tree, QuickKeys *keys, QuickCurve *curves, Params *params) {
+DelayedScenario::DelayedScenario(LetterTree *tree, QuickKeys *keys, QuickCurve *curves, Params *params, MultiContext *context) {
   dead = nextOk = false;
   debug = false;
+  birth = death = -1;
 
   multi = false;
   single_p.reset(new Scenario(tree, keys, curves, params));
 
   this -> params = params;
   this -> keys = keys;
+  this -> context = context;
   curve_count = 0;
 
-  MultiScenario::init(); // static context -> bad
+  context -> init();
+
+  memAdd(params?params->glob_mem:NULL);
 };
 
 DelayedScenario::DelayedScenario(const DelayedScenario &from) {
@@ -29,37 +38,83 @@ DelayedScenario::DelayedScenario(const DelayedScenario &from) {
   next = from.next;
   nextOk = from.nextOk;
   debug = from.debug;
+  birth = from.birth;
+  death = from.death;
 
   multi = from.multi;
   multi_p = from.multi_p;
   single_p = from.single_p;
   params = from.params;
   keys = from.keys;
+  context = from.context;
   curve_count = from.curve_count;
+
+  memAdd(from.mem);
 }
 
 DelayedScenario::DelayedScenario(const MultiScenario &from) {
   dead = nextOk = false;
   debug = from.debug;
+  birth = death = -1;
 
   multi = true;
   multi_p.reset(new MultiScenario(from));
 
   params = from.params;
   keys = from.keys;
+  context = from.context;
   curve_count = multi_p.data() -> curve_count;
+
+  memAdd(params?params->glob_mem:NULL);
 }
 
-DelayedScenario::DelayedScenario(const Scenario &from) {
+DelayedScenario::DelayedScenario(const Scenario &from, MultiContext *context) {
   dead = nextOk = false;
   debug = from.debug;
+  birth = death = -1;
 
   multi = false;
   single_p.reset(new Scenario(from));
 
   params = from.params;
   keys = from.keys;
+  this -> context = context;
+  curve_count = 1;
+
+  memAdd(params?params->glob_mem:NULL);
+}
+
+/* the following constructors take ownership of (shared) scenarios returned by childScenario() */
+DelayedScenario::DelayedScenario(MultiScenarioHandle from) {
+  dead = nextOk = false;
+  debug = from -> debug;
+  birth = death = -1;
+
+  multi = true;
+  multi_p = from;
+
+  params = from -> params;
+  keys = from -> keys;
+  context = from -> context;
+  curve_count = from -> curve_count;
+
+  memAdd(params?params->glob_mem:NULL);
+}
+
+DelayedScenario::DelayedScenario(ScenarioHandle from, MultiContext *context) {
+  dead = nextOk = false;
+  debug = from -> debug;
+  birth = death = -1;
+
+  multi = false;
+  single_p = from;
+
+  params = from -> params;
+  keys = from -> keys;
+  this -> context = context;
   curve_count = 1;
+
+  memAdd(params?params->glob_mem:NULL);
 }
 
 DelayedScenario& DelayedScenario::operator=(const DelayedScenario &from) {
@@ -69,9 +124,12 @@ DelayedScenario& DelayedScenario::operator=(const DelayedScenario &from) {
   this->next.clear();
   this->nextOk = false;
   this->debug = from.debug;
+  this->birth = from.birth;
+  this->death = from.death;
 
   this->params = from.params;
   this->keys = from.keys;
+  this->context = from.context;
   this->multi = from.multi;
   this->curve_count = from.curve_count;
 
@@ -79,9 +137,20 @@ DelayedScenario& DelayedScenario::operator=(const DelayedScenario &from) {
 };
 
 DelayedScenario::~DelayedScenario() {
-  // nothing to do: smart pointers are smart :)
+  // nothing else to do: smart pointers are smart :)
+  if (mem) { mem->remove(MEM_DELAYED, sizeof(DelayedScenario)); }
 };
 
+void DelayedScenario::memAdd(MemStats *mem) {
+  this -> mem = mem;
+  if (mem) { mem->add(MEM_DELAYED, sizeof(DelayedScenario)); }
+}
+
+int DelayedScenario::getMemory() {
+  /* approximate memory used by a delayed scenario and the scenario it holds */
+  return sizeof(DelayedScenario) + (multi?multi_p.data()->getMemory(true):single_p.data()->getMemory());
+}
+
 
 bool DelayedScenario::operator<(const DelayedScenario &other) const {
   if (multi) {
@@ -91,6 +160,16 @@ bool DelayedScenario::operator<(const DelayedScenario &other) const {
   }
 }
 
+DelayedScenario DelayedScenario::frozenCopy(int death) {
+  /* lightweight copy for fallback snapshots: scenario is shared, and we don't need
+     to keep (or detach) next letters table */
+  DelayedScenario copy(*this);
+  copy.next.clear();
+  copy.nextOk = false;
+  copy.death = death;
+  return copy;
+}
+
 bool DelayedScenario::isFinished() {
   return SC_METHOD(isFinished);
 }
@@ -103,7 +182,7 @@ void DelayedScenario::setDebug(bool value) {
 void DelayedScenario::setCurveCount(int count) {
   if (count > 1 && ! multi) {
     multi = true;
-    this -> multi_p.reset(new MultiScenario(*(this -> single_p.data())));
+    this -> multi_p.reset(new MultiScenario(*(this -> single_p.data()), context));
     this -> single_p.clear();
   }
   SC_METHOD(setCurveCount, count);
@@ -142,7 +221,7 @@ MultiScenario DelayedScenario::getMultiScenario() {
   if (multi) {
     return MultiScenario(*(this -> multi_p.data()));
   } else {
-    return MultiScenario(*(this -> single_p.data()));
+    return MultiScenario(*(this -> single_p.data()), context);
   }
 }
 
@@ -158,6 +237,23 @@ QString DelayedScenario::getName() {
   return SC_METHOD(getName);
 }
 
+void NextLetters::setCurveCount(int curve_count) {
+  this -> curve_count = curve_count;
+  if (curve_count > 1) {
+    length_multi.resize(2 * curve_count * __builtin_popcount(all));
+  } else {
+    length_multi.clear();
+  }
+}
+
+const int* NextLetters::getLengths(int bit) const {
+  return ((curve_count > 1)?length_multi.constData():length) + index(bit);
+}
+
+int* NextLetters::updateLengths(int bit) {
+  return ((curve_count > 1)?length_multi.data():length) + index(bit);
+}
+
 void DelayedScenario::updateNextLetters() {
   if (isFinished()) { return; }
 
@@ -165,47 +261,51 @@ void DelayedScenario::updateNextLetters() {
 
   foreach (LetterNode child, getNode().getChilds()) {
     unsigned char letter = child.getChar();
+    int bit = NEXT_LETTER_BIT(letter);
 
-    // diacritic keys support
-    unsigned char *ptr = keys->getKeysForLetter(letter);
-
-    if (! ptr) {
+    if (bit <= 0 || bit >= 32 || ! keys->getKeysForLetter(letter)) {
       // unknown key, ignore child and avoid crashing
       DBG("Unknown key for letter '%c'", letter);
       continue;
     }
 
-    while(* ptr) {
-      next[* ptr] = NextLetter(child);
-      ptr ++;
-    }
+    next.all |= (1U << bit);
   }
+  next.mask = next.all;
 
   nextOk = true;
   updateNextLength();
 }
 
 void DelayedScenario::updateNextLength() {
-  /* compute length threshold for next iterations (for each possible key) */
+  /* compute length threshold for next iterations (for each possible letter) */
 
   if (! nextOk) { updateNextLetters(); return; }
 
-  QHash<unsigned char, NextLetter>::iterator it;
-  for(it = next.begin(); it != next.end(); it ++) {
-    while (it.value().next_length.size() < 2 * curve_count) { it.value().next_length.append(0); }
+  next.setCurveCount(curve_count);
 
-    for(int curve_id = 0; curve_id < curve_count; curve_id ++) {
-      unsigned char next_letter = it.key();
-      int min_length = 0, max_length = 0;
+  for(int bit = 1; bit < 32; bit ++) {
+    if (! (next.mask & (1U << bit))) { continue; }
+    int *lengths = next.updateLengths(bit);
 
-      if (! nextLength(next_letter, curve_id, min_length, max_length)) {
-	min_length = max_length = -1; // e.g. trying to add letter to finished sub-scenario
+    unsigned char letter = 96 + bit;
+    for(int curve_id = 0; curve_id < curve_count; curve_id ++) {
+      /* diacritic support: a letter can match multiple keys, childScenario()
+	 tries them all so we just need the lowest thresholds */
+      int min_length = -1, max_length = -1;
+      unsigned char *ptr = keys->getKeysForLetter(letter);
+      while (ptr && * ptr) {
+	int min1 = 0, max1 = 0;
+	if (nextLength(* ptr, curve_id, min1, max1)) {
+	  if (min_length == -1 || min1 < min_length) { min_length = min1; }
+	  if (max_length == -1 || max1 < max_length) { max_length = max1; }
+	} // else e.g. trying to add letter to finished sub-scenario
+	ptr ++;
       }
 
-      it.value().next_length[curve_id * 2] = min_length;
-      it.value().next_length[curve_id * 2 + 1] = max_length;
+      lengths[curve_id * 2] = min_length;
+      lengths[curve_id * 2 + 1] = max_length;
     }
-
   }
 }
 
@@ -214,25 +314,34 @@ void DelayedScenario::getChildsIncr(QList<DelayedScenario> &childs, bool curve_f
 
   if (! nextOk) { updateNextLetters(); }
 
-  QList<MultiScenario> tmpListM;
-  QList<Scenario> tmpListS;
+  QList<MultiScenarioHandle> tmpListM;
+  QList<ScenarioHandle> tmpListS;
+  QList<LetterNode> childNodes; // only retrieved if a child letter must be evaluated
+
+  for(int bit = 1; bit < 32; bit ++) {
+    if (! (next.mask & (1U << bit))) { continue; }
+    unsigned char letter = 96 + bit;
 
-  QHash<unsigned char, NextLetter>::iterator it = next.begin();
-  while (it != next.end()) {
-    LetterNode childNode = it.value().letter_node;
     bool flag_found = false, flag_wait = false;
 
     for (int curve_id = 0; curve_id < curve_count; curve_id ++) {
       /* in "aggressive matching" try to evaluate child scenarios as soon as possible,
 	 even it causes a lot of retries ... */
+      const int *lengths = next.getLengths(bit);
       int nl_index = curve_id * 2;
-      int min_length = aggressive * it.value().next_length[nl_index] + (1 - aggressive) * it.value().next_length[nl_index + 1];
+      int min_length = aggressive * lengths[nl_index] + (1 - aggressive) * lengths[nl_index + 1];
       int cur_length = getTotalLength(curve_id);
 
       if (min_length == -1) {
 	// no child possible for this curve. never retry
 
       } else if (cur_length > min_length || curve_finished) {
+	if (childNodes.isEmpty()) { childNodes = getNode().getChilds(); }
+	LetterNode childNode;
+	foreach(LetterNode child, childNodes) {
+	  if (child.getChar() == letter) { childNode = child; break; }
+	}
+
 	st.st_count += 1;
 	DBG("[INCR] Evaluate: %s + '%c' [curve_id=%d]", QSTRING2PCHAR(getId()), childNode.getChar(), curve_id);
 
@@ -255,46 +364,45 @@ void DelayedScenario::getChildsIncr(QList<DelayedScenario> &childs, bool curve_f
 	  // we are too close to the end of the curve, we'll have to retry later (only occurs when curve is not finished)
 	  DBG("[INCR] Retry: %s + '%c'", QSTRING2PCHAR(getId()), childNode.getChar());
 	  st.st_retry += 1;
-	  it.value().next_length[nl_index]     += params->incr_retry;
-	  it.value().next_length[nl_index + 1] += params->incr_retry;
+	  int *retry_lengths = next.updateLengths(bit);
+	  retry_lengths[nl_index]     += params->incr_retry;
+	  retry_lengths[nl_index + 1] += params->incr_retry;
 	  flag_wait = true;
 	}
 
       } else {
-	// Too noisy: DBG("[INCR] Waiting: %s + '%c'", QSTRING2PCHAR(scenario.getId()), childNode.getChar());
+	// Too noisy: DBG("[INCR] Waiting: %s + '%c'", QSTRING2PCHAR(scenario.getId()), letter);
 	flag_wait = true;
       }
     }
     if (flag_found || (! flag_wait)) {
-      it = next.erase(it); // no more retry needed for childs with this letter
-    } else {
-      it ++;
+      next.mask &= ~ (1U << bit); // no more retry needed for childs with this letter
     }
   }
 
   QList<DelayedScenario> new_ds;
 
   if (multi) {
-    foreach(MultiScenario sc, tmpListM) {
-      DBG("[INCR] New scenario: %s", QSTRING2PCHAR(sc.getId()));
+    foreach(MultiScenarioHandle sc, tmpListM) {
+      DBG("[INCR] New scenario: %s", QSTRING2PCHAR(sc->getId()));
       DelayedScenario ds = DelayedScenario(sc);
-      if (recursive && ! sc.isFinished()) {
+      if (recursive && ! sc->isFinished()) {
 	ds.getChildsIncr(childs, curve_finished, st, recursive, aggressive);
       }
       childs.append(ds);
     }
   } else {
-    foreach(Scenario sc, tmpListS) {
-      DBG("[INCR] New scenario: %s", QSTRING2PCHAR(sc.getId()));
-      DelayedScenario ds = DelayedScenario(sc);
-      if (recursive && ! sc.isFinished()) {
+    foreach(ScenarioHandle sc, tmpListS) {
+      DBG("[INCR] New scenario: %s", QSTRING2PCHAR(sc->getId()));
+      DelayedScenario ds = DelayedScenario(sc, context);
+      if (recursive && ! sc->isFinished()) {
 	ds.getChildsIncr(childs, curve_finished, st, recursive, aggressive);
       }
       childs.append(ds);
     }
   }
 
-  if (! next.size()) { die(); } // we have explored all possible child scenarios
+  if (! next.mask) { die(); } // we have explored all possible child scenarios
 }
 
 
@@ -302,9 +410,10 @@ int DelayedScenario::getNextLength(int curve_id, float aggressive) {
   if (! nextOk) { updateNextLetters(); }
 
   int next_length = 0;
-  QHash<unsigned char, NextLetter>::iterator it;
-  for(it = next.begin(); it != next.end(); it ++) {
-    int length = aggressive * it.value().next_length[curve_id * 2] + (1 - aggressive) * it.value().next_length[curve_id * 2 + 1];
+  for(int bit = 1; bit < 32; bit ++) {
+    if (! (next.mask & (1U << bit))) { continue; }
+    const int *lengths = next.getLengths(bit);
+    int length = aggressive * lengths[curve_id * 2] + (1 - aggressive) * lengths[curve_id * 2 + 1];
     if (length > 0 && (length < next_length || ! next_length)) { next_length = length; }
   }
   return next_length;
@@ -318,32 +427,104 @@ void DelayedScenario::display(char *prefix) {
   ts << "DelayedScenario(" << getId() << "): score=" << getScore();
   if (dead) { ts << " [DEAD]"; }
   if (isFinished()) { ts << " [finished]"; }
-  foreach(unsigned char letter, next.keys()) {
-    ts << " " << QString(letter) << ":";
-    bool first = true;
-    foreach(int d, next[letter].next_length) {
-      if (! first) { ts << ","; } else { first = false; }
-      ts << d;
+  for(int bit = 1; bit < 32; bit ++) {
+    if (! (next.mask & (1U << bit))) { continue; }
+    ts << " " << QString(QChar(96 + bit)) << ":";
+    const int *lengths = next.getLengths(bit);
+    for(int i = 0; i < 2 * next.curve_count; i ++) {
+      if (i) { ts << ","; }
+      ts << lengths[i];
     }
   }
   DBG("%s%s", prefix?prefix:"", QSTRING2PCHAR(txt));
 }
 
-void DelayedScenario::deepDive(QList<Scenario> &result) {
+void DelayedScenario::deepDive(QList<Scenario> &result, float min_score, const QSet<int> *filter) {
   if (multi) { return; } // not supported at the moment
 
-  single_p.data()->deepDive(result);
+  single_p.data()->deepDive(result, min_score, filter);
+}
+
+
+static bool scenarioGreater(const Scenario &s1, const Scenario &s2) {
+  return s2 < s1;
+}
+
+FallbackJob::FallbackJob(const QList<DelayedScenario> *ds_list, const QSet<QString> *dedupe, int min_length, int max_size, int timeout, const QSet<int> *filter) {
+  this -> ds_list = ds_list;
+  this -> filter = filter;
+  this -> dedupe = dedupe;
+  this -> min_length = min_length;
+  this -> max_size = max_size;
+  this -> timeout = timeout;
+  next_index = 0;
+  timed_out = 0;
+  timer.start();
+}
+
+float FallbackJob::cutoff() {
+  QMutexLocker locker(&mutex);
+  if (heap.size() < max_size) { return 0; } // same as default deepDive behaviour
+  return heap.first().getScore();
+}
+
+void FallbackJob::add(QList<Scenario> &list) {
+  QMutexLocker locker(&mutex);
+  foreach(Scenario s, list) {
+    if (heap.size() < max_size) {
+      heap.append(s);
+      std::push_heap(heap.begin(), heap.end(), scenarioGreater);
+    } else if (heap.first() < s) {
+      std::pop_heap(heap.begin(), heap.end(), scenarioGreater);
+      heap.last() = s;
+      std::push_heap(heap.begin(), heap.end(), scenarioGreater);
+    }
+  }
 }
 
+void FallbackJob::work() {
+  /* worker loop (run in parallel by all fallback threads) */
+  forever {
+    if (timed_out.loadAcquire()) { return; }
+
+    int k = next_index.fetchAndAddOrdered(1);
+    if (k >= ds_list->size()) { return; }
+    DelayedScenario ds = ds_list->at(ds_list->size() - 1 - k); // list is sorted, best scenarios come first
+
+    QString name = ds.getName();
+    if (name.length() < min_length) { continue; }
+
+    QString parent = name.left(name.length() - 1);
+    if (dedupe->contains(parent)) { continue; }
+
+    QList<Scenario> list;
+    ds.deepDive(list, cutoff(), filter);
+    add(list);
+
+    if (timer.elapsed() > timeout) {
+      // timebox fallback time
+      // during tests it was always acceptable, but there is no upper bound on
+      // time required to process all possible scenarios, so let's stay on the safe side
+      if (! timed_out.fetchAndStoreOrdered(1)) { logdebug("[fallbak: TIMEOUT!]"); }
+      return;
+    }
+  }
+}
 
-NextLetter::NextLetter(LetterNode node) {
-  letter_node = node;
+QList<Scenario> FallbackJob::getResult() {
+  QMutexLocker locker(&mutex);
+  return heap;
 }
-NextLetter::NextLetter() {} // it makes QHash happy
 
 
-IncrementalMatch::IncrementalMatch() {
+IncrementalMatch::IncrementalMatch(QSharedPointer<MatchEngine> engine) : CurveMatch(engine) {
   delayed_scenarios_p = new QList<DelayedScenario>();
+  interrupt_flag = NULL;
+  generation = 0;
+  provisional_ready = false;
+  beam_width = 0; // not initialized (use max_active_scenarios)
+  final_filter = false;
+  deadline_timer.invalidate();
 }
 
 IncrementalMatch::~IncrementalMatch() {
@@ -351,45 +532,93 @@ IncrementalMatch::~IncrementalMatch() {
 }
 
 void IncrementalMatch::purge_snapshots() {
-  DBG("[purge snapshots: %d]", ds_snapshots.size());
-  for(int i = 0;i < ds_snapshots.size(); i++) {
-    delete ds_snapshots[i];
-  }
+  DBG("[purge snapshots: %d, graveyard: %d]", ds_snapshots.size(), ds_graveyard.size());
   ds_snapshots.clear();
+  ds_graveyard.clear();
 }
 
 #define delayed_scenarios (*delayed_scenarios_p)
 
+QList<DelayedScenario> IncrementalMatch::getSnapshot(int gen) {
+  /* rebuild beam as it was at a given generation */
+  QList<DelayedScenario> result;
+  foreach(DelayedScenario ds, ds_graveyard) {
+    if (ds.birth <= gen && ds.death > gen) { result.append(ds); }
+  }
+  for(int i = 0; i < delayed_scenarios.size(); i ++) {
+    if (delayed_scenarios[i].birth <= gen) { result.append(delayed_scenarios[i].frozenCopy(-1)); }
+  }
+  return result;
+}
+
 void IncrementalMatch::incrementalMatchBegin() {
   /* incremental algorithm: first iteration */
   delayed_scenarios.clear();
   candidates.clear();
   purge_snapshots();
 
-  if (! loaded || ! keys.size()) { return; }
+  if (! attachTree() || ! keys.size()) { return; }
+
+  // dictionary filter is only used in the final pass: build its index while the user is drawing
+  prepareIndex(false);
 
   computeScalingRatio();
 
+  params.glob_mem = params.mem_stats?&mem:NULL;
+  mem.resetPeak();
+
   quickKeys.setParams(&params);
   quickKeys.setKeys(keys, scaling_ratio);
   setCurves();
 
-  DelayedScenario root(&wordtree, &quickKeys, (QuickCurve*) &quickCurves, &params);
+  DelayedScenario root(wordtree.data(), &quickKeys, (QuickCurve*) &quickCurves, &params, &multi_context);
   root.setDebug(debug);
   root.setCurveCount(curve_count);
+  root.birth = generation = 0;
 
   memset(next_iteration_length, 0, sizeof(next_iteration_length));
 
   delayed_scenarios.append(root);
 
+  early_prefix = QString();
+  early_words.clear();
+  provisional.clear();
+  provisional_ready = false;
+
+  st.st_beam_width = st.st_beam_min = getBeamWidth(params.max_active_scenarios);
+
   last_snapshot_count = 0;
 
   DBG("incrementalMatchBegin: scenarios=%d", delayed_scenarios.size());
 
 }
 
-void IncrementalMatch::aggressiveMatch() {
-  incrementalMatchUpdate(false, 1.0);
+bool IncrementalMatch::aggressiveMatch(float aggressive) {
+  /* speculative iteration run while waiting for new points: child scenarios
+     are evaluated as soon as possible (see "aggressive" parameter), and the
+     whole iteration is thrown away if new points arrive in the meantime */
+  if (done) { return false; }
+  update_next_iteration_length(aggressive);
+  bool result = incrementalMatchUpdate(false, aggressive, true);
+  update_next_iteration_length(params.aggressive_mode); // back to normal thresholds
+  return result;
+}
+
+bool IncrementalMatch::interrupted() {
+  return interrupt_flag && interrupt_flag->loadAcquire();
+}
+
+int IncrementalMatch::remainingTime() {
+  /* time left (ms) before final matching deadline, -1 = no deadline */
+  if (deadline <= 0) { return -1; }
+  int left = deadline - (int) deadline_timer.elapsed();
+  return (left > 0)?left:0;
+}
+
+float IncrementalMatch::budgetLeft() {
+  /* ratio of deadline still available (1 = all of it or no deadline) */
+  if (deadline <= 0) { return 1.0; }
+  return (float) remainingTime() / deadline;
 }
 
 QString IncrementalMatch::getLengthStr() {
@@ -402,16 +631,18 @@ QString IncrementalMatch::getLengthStr() {
   return txt;
 }
 
-void IncrementalMatch::incrementalMatchUpdate(bool finished, float aggressive) {
-  /* incremental algorithm: subsequent iterations */
-  if (! loaded || ! keys.size()) { return; }
+bool IncrementalMatch::incrementalMatchUpdate(bool finished, float aggressive, bool speculative) {
+  /* incremental algorithm: subsequent iterations
+     in speculative mode, the iteration works on a copy of the delayed scenarios and
+     can be cancelled at any time (return value is false if nothing has been done) */
+  if (wordtree.isNull() || ! keys.size()) { return false; }
 
-  if (delayed_scenarios.size() == 0 && ! finished) { return; }
-  if (curve.size() < 5 && ! finished ) { return; }
+  if (delayed_scenarios.size() == 0 && ! finished) { return false; }
+  if (curve.size() < 5 && ! finished ) { return false; }
 
   // update preprocess pass (curve may have new points since last iteration)
   if (setCurves()) {
-    return; // some curve is on hold
+    return false; // some curve is on hold
     // note: this will be inefficient il multi-touch mode (@todo try a per-curve approach)
   }
 
@@ -435,8 +666,10 @@ void IncrementalMatch::incrementalMatchUpdate(bool finished, float aggressive) {
     if (current_length[i] >= next_iteration_length[i]) { proceed = true; }
   }
 
-  logdebug("[== incrementalMatchUpdate: finished=%d, curveIndex=%d, length=[%s], proceed=%d, aggressive=%.2f, scaling_ratio=%.2f",
-	   finished, curve.size(), QSTRING2PCHAR(getLengthStr()), proceed, aggressive, scaling_ratio);
+  if (speculative && ! proceed) { return false; }
+
+  logdebug("[== incrementalMatchUpdate: finished=%d, curveIndex=%d, length=[%s], proceed=%d, aggressive=%.2f, scaling_ratio=%.2f%s",
+	   finished, curve.size(), QSTRING2PCHAR(getLengthStr()), proceed, aggressive, scaling_ratio, speculative?" [speculative]":"");
 
   if (debug) {
     for(int i = 0; i < delayed_scenarios.size(); i ++) {
@@ -445,35 +678,109 @@ void IncrementalMatch::incrementalMatchUpdate(bool finished, float aggressive) {
     }
   }
 
-  next_iteration_index = curve.size() + params.incremental_index_gap;
+  if (! speculative) { next_iteration_index = curve.size() + params.incremental_index_gap; }
+
+  if ((! proceed) && (! finished)) { return false; }
 
-  if ((! proceed) && (! finished)) { return; }
+  TraceScope trace(finished?"final iteration":(speculative?"speculative iteration":"iteration"), delayed_scenarios.size());
 
   QTime t_start = QTime::currentTime();
+  QElapsedTimer iteration_timer;
+  iteration_timer.start();
 
   memset(next_iteration_length, 0, sizeof(next_iteration_length));
 
+  /* in speculative mode we must be able to cancel the iteration, so we work
+     on a copy of the delayed scenarios list (getChildsIncr updates them) */
+  QList<DelayedScenario> *source_p = delayed_scenarios_p;
+  stats_t st_save = st;
+  if (speculative) {
+    source_p = new QList<DelayedScenario>();
+    foreach(DelayedScenario ds, delayed_scenarios) {
+      DelayedScenario copy(ds);
+      if (ds.dead) { copy.die(); } // copy constructor does not keep this flag
+      source_p->append(copy);
+    }
+  }
+
+  if (finished) {
+    // gesture is complete: we know its start & end keys and its length
+    // (nodes of learned words are always included, and if the index is not ready yet, nothing is filtered)
+    final_nodes.clear();
+    final_filter = dictionaryFilter(final_nodes, false);
+  }
+
+  bool anytime = finished && deadline > 0;
+  if (anytime) {
+    // best scenarios first, so we can stop at any time
+    qSort(source_p->begin(), source_p->end());
+    std::reverse(source_p->begin(), source_p->end());
+  }
+
   QList<DelayedScenario> *new_delayed_scenarios_p = new QList<DelayedScenario>();
+  QList<DelayedScenario> dying; // scenarios leaving the beam (they may still be needed by fallback snapshots)
 
   /* note: the incremental algorithm works in a single thread at the moment, but if less
      latency is needed, it can be made fully parallel by distributing the following loop
      over multiple cores.
      Not tried yet, as on the Jolla, this may slow down the GUI thread */
 
-  for(int i = 0; i < delayed_scenarios.size(); i ++) {
-    DelayedScenario *ds = &(delayed_scenarios[i]);
+  for(int i = 0; i < source_p->size(); i ++) {
+    if (speculative && interrupted()) {
+      // new points are available: give up and let the normal iteration do the job
+      logdebug("==] incrementalMatchUpdate: speculative iteration cancelled (%d/%d) [time=%.3f]",
+	       i, source_p->size(), (float)(t_start.msecsTo(QTime::currentTime())) / 1000);
+      delete new_delayed_scenarios_p;
+      delete source_p;
+      st = st_save;
+      st.st_spec_abort ++;
+      return false;
+    }
+
+    if (anytime && i > 0 && i >= source_p->size() * budgetLeft()) {
+      // beam shrinks as time budget runs out (and drop everything left when deadline has expired)
+      logdebug("[deadline] final iteration truncated (%d/%d) [remaining=%dms]", i, source_p->size(), remainingTime());
+      st.st_truncated = 1;
+      if (ds_snapshots.size()) {
+	for(int j = i; j < source_p->size(); j ++) { dying.append((*source_p)[j].frozenCopy(generation + 1)); }
+      }
+      break;
+    }
+
+    DelayedScenario *ds = &((*source_p)[i]);
     if (debug) { ds->display((char*) "DS> "); }
-    if (ds->dead) { continue; }
+    if (ds->dead) { dying.append(ds->frozenCopy(generation + 1)); continue; }
+
+    if (finished && final_filter && ! final_nodes.contains(ds->getNode().getIndex())) {
+      // no word compatible with the gesture below this scenario
+      st.st_bucket_cut ++;
+      ds->die();
+      dying.append(ds->frozenCopy(generation + 1));
+      continue;
+    }
 
-    ds->getChildsIncr(*new_delayed_scenarios_p, finished, st, true, aggressive); // getChildsIncr will fail fast if curves length are not high enough
-    if (ds->dead) { continue; } // DelayedScenarios will "die" when all their possible childs has been created
+    {
+      PhaseTimer timer(st.st_t_expand);
+      ds->getChildsIncr(*new_delayed_scenarios_p, finished, st, true, aggressive); // getChildsIncr will fail fast if curves length are not high enough
+    }
+    if (ds->dead) { dying.append(ds->frozenCopy(generation + 1)); continue; } // DelayedScenarios will "die" when all their possible childs has been created
 
     new_delayed_scenarios_p->append(*ds);
   }
 
+  if (speculative) {
+    // iteration is complete: results are valid for the current curve so we keep them
+    delete source_p;
+    st.st_spec_ok ++;
+  }
+
+  generation ++;
+  ds_graveyard.append(dying);
+
   // find candidates
   int c_total = 0, c_count = 0;
   for(int i = 0 ; i < new_delayed_scenarios_p->size(); i ++) {
+    if ((*new_delayed_scenarios_p)[i].birth < 0) { (*new_delayed_scenarios_p)[i].birth = generation; }
     if ((*new_delayed_scenarios_p)[i].isFinished()) {
       if ((*new_delayed_scenarios_p)[i].getWordList().size()) {
 	// This test is a workaround for a real bug (@todo fix this)
@@ -490,21 +797,29 @@ void IncrementalMatch::incrementalMatchUpdate(bool finished, float aggressive) {
   QList<DelayedScenario> *old_dsp = delayed_scenarios_p;
   delayed_scenarios_p = new_delayed_scenarios_p;
 
-  // keep snapshot for later backtracking with the fallback algorithm
+  // keep snapshot for later backtracking with the fallback algorithm (this is just the previous generation number)
   int avg_count = c_total / (c_count?c_count:1);
   if (avg_count >= params.fallback_start_count && avg_count > last_snapshot_count && delayed_scenarios.size() > 0) {
     DBG("[Taking snapshot: %d, size: %d]", avg_count, old_dsp->size());
     last_snapshot_count = avg_count;
-    ds_snapshots.append(old_dsp);
-    if (ds_snapshots.size() > params.fallback_snapshot_queue) { delete ds_snapshots.takeFirst(); }
-  } else {
-    delete old_dsp;
+    ds_snapshots.append(generation - 1);
+    if (ds_snapshots.size() > params.fallback_snapshot_queue) { ds_snapshots.removeFirst(); }
   }
+  delete old_dsp;
+
+  // scenarios which have left the beam before the oldest snapshot are not needed anymore
+  int oldest = ds_snapshots.size()?ds_snapshots[0]:generation;
+  while (ds_graveyard.size() && ds_graveyard[0].death <= oldest) { ds_graveyard.removeFirst(); }
 
   delayedScenariosFilter();
 
+  // final iteration is not representative (and there is nothing left to adjust)
+  if (! finished && ! speculative) { adjustBeamWidth((int) iteration_timer.elapsed()); }
+
   update_next_iteration_length(aggressive);
 
+  if (! finished) { checkEarlyResult(); }
+
   if (finished) {
     /* this is the last iteration: compute final scores for candidates */
 
@@ -517,11 +832,22 @@ void IncrementalMatch::incrementalMatchUpdate(bool finished, float aggressive) {
 
     purge_snapshots();
 
+    TraceScope trace_post("post-processing", candidates.size());
     curvePreprocess2();
+    if (anytime) {
+      qSort(candidates.begin(), candidates.end());
+      std::reverse(candidates.begin(), candidates.end());
+    }
     QList<ScenarioType> new_candidates;
-    foreach(ScenarioType s, candidates) {
-      if (s.postProcess(st)) {
-	new_candidates.append(s);
+    for(int i = 0; i < candidates.size(); i ++) {
+      if (anytime && new_candidates.size() && ! remainingTime()) {
+	logdebug("[deadline] post-processing truncated (%d/%d)", i, candidates.size());
+	st.st_truncated = 1;
+	break;
+      }
+      PhaseTimer timer(st.st_t_postprocess);
+      if (candidates[i].postProcess(st)) {
+	new_candidates.append(candidates[i]);
       }
     }
     candidates = new_candidates;
@@ -534,67 +860,176 @@ void IncrementalMatch::incrementalMatchUpdate(bool finished, float aggressive) {
 
     storeKeyPos();
 
+    if (! early_words.isEmpty()) {
+      // final pass confirms (or amends) the provisional result: best candidate must be in the provisional list
+      int best = -1;
+      for(int i = 0; i < candidates.size(); i ++) {
+	if (best < 0 || candidates[best] < candidates[i]) { best = i; }
+      }
+      st.st_early_ok = (best >= 0 && early_words.contains(candidates[best].getName()));
+      logdebug("[early] provisional result: %s -> %s (%s)", QSTRING2PCHAR(early_prefix), st.st_early_ok?"confirmed":"amended",
+	       (best >= 0)?QSTRING2PCHAR(candidates[best].getName()):"-");
+    }
+
     // cache stats
     int n = st.st_cache_hit;
     int d = st.st_cache_hit + st.st_cache_miss;
     if (d) {
-      logdebug("Cache stats: access count: %d, hit ratio: %.2f%%", d, 100.0 * n / d);
+      logdebug("Cache stats: access count: %d, hit ratio: %.2f%% (negative: %d), memory: %dkB",
+	       d, 100.0 * n / d, st.st_cache_neg, st.st_cache_mem / 1024);
     }
 
+    if (params.mem_stats) {
+      // memory retained for backtracking at the end of the match (scenarios are shared with the beam, so this is an upper bound)
+      st.st_mem_snapshot = 0;
+      for(int i = 0; i < ds_graveyard.size(); i ++) { st.st_mem_snapshot += ds_graveyard[i].getMemory(); }
+    }
+    updateMemStats();
+    updateLoadStats();
+    logPhaseTimes();
+
   }
   logdebug("==] incrementalMatchUpdate: curveIndex=%d, finished=%d, scenarios=%d, skim=%d, fork=%d, nodes=%d, retry=%d [time=%.3f]",
 	   curve.size(), finished, delayed_scenarios.size(),
 	   st.st_skim, st.st_fork, st.st_count, st.st_retry,
 	   (float)(t_start.msecsTo(QTime::currentTime())) / 1000);
+
+  return true;
+}
+
+static QThreadPool *fallbackPool() {
+  /* process-wide pool for parallel fallback (cf. fallback_threads parameter) */
+  static QThreadPool *pool = NULL;
+  static QMutex mutex;
+  QMutexLocker locker(&mutex);
+  if (! pool) {
+    pool = new QThreadPool();
+    pool -> setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1)); // calling thread is also a worker
+  }
+  return pool;
 }
 
 void IncrementalMatch::fallback(QList<ScenarioType> &result) {
+  PhaseTimer timer(st.st_t_fallback);
+  TraceScope trace("fallback");
   if (ds_snapshots.size() == 0) { return; }
-  QList<DelayedScenario> *ds_list = ds_snapshots[0];
-  logdebug("[fallback, size: %d]", ds_list->size());
+  QList<DelayedScenario> ds_list = getSnapshot(ds_snapshots[0]);
+  logdebug("[fallback, size: %d]", ds_list.size());
 
-  if (ds_list->size() == 0) { return; }
+  if (ds_list.size() == 0) { return; }
 
   QSet<QString> dedupe;
-  for(int i = ds_list->size() - 1; i >= 0; i --) {
-    QString name = (*ds_list)[i].getName();
+  for(int i = ds_list.size() - 1; i >= 0; i --) {
+    QString name = ds_list[i].getName();
     if (name.length() < params.fallback_min_length) { continue; }
     dedupe.insert(name);
   }
 
-  qSort(ds_list->begin(), ds_list->end());
+  qSort(ds_list.begin(), ds_list.end());
+
+  int timeout = params.fallback_timeout;
+  int left = remainingTime();
+  bool deadline_timeout = (left >= 0 && left < timeout);
+  if (deadline_timeout) { timeout = left; }
+
+  FallbackJob job(&ds_list, &dedupe, params.fallback_min_length, params.fallback_max_candidates * 3, timeout, final_filter?&final_nodes:NULL);
+
+  /* workers are only started if a pool thread is available right now (the
+     pool is shared by all sessions): current thread always takes part, so
+     fallback never waits for other sessions */
+  int threads = (params.fallback_threads > 0)?params.fallback_threads:QThread::idealThreadCount();
+  QSemaphore done;
+  int started = 0;
+  for(int i = 1; i < threads; i ++) {
+    FallbackWorker *worker = new FallbackWorker(&job, &done);
+    if (! fallbackPool() -> tryStart(worker)) { delete worker; break; }
+    started ++;
+  }
+  job.work();
+  done.acquire(started);
 
-  QTime startTime = QTime::currentTime();
+  if (job.timed_out.loadAcquire() && deadline_timeout) { st.st_truncated = 1; }
 
-  QList<Scenario> list;
-  for(int i = ds_list->size() - 1; i >= 0; i --) {
-    QString name = (*ds_list)[i].getName();
-    if (name.length() < params.fallback_min_length) { continue; }
+  QList<Scenario> list = job.getResult();
+  DBG("[fallback: %d candidates, threads: %d]", list.size(), started + 1);
+  foreach(Scenario s, list) {
+    result.append(MultiScenario(s, &multi_context));
+  }
+}
 
-    QString parent = name.left(name.length() - 1);
-    if (dedupe.contains(parent)) { continue; }
+static int subtreeDepth(LetterNode node, int max_depth) {
+  /* depth of the tree below a node (stops counting at max_depth) */
+  if (node.isLeaf() || max_depth <= 0) { return 0; }
+  int depth = 0;
+  foreach(LetterNode child, node.getChilds()) {
+    int d = 1 + subtreeDepth(child, max_depth - 1);
+    if (d > depth) { depth = d; }
+  }
+  return depth;
+}
 
-    (*ds_list)[i].deepDive(list);
-    if (list.size() > params.fallback_max_candidates * 4) {
-      qSort(list.begin(), list.end());
-      DBG("[fallback: trimming list (%d) ]", list.size());
-      list = list.mid(list.size() - params.fallback_max_candidates * 3);
-    }
+static void subtreeWords(LetterNode node, QString name, QList<QPair<QString, QString> > &result) {
+  if (node.hasPayload()) {
+    result.append(QPair<QString, QString>(name, QString((char*) node.getPayload().first)));
+  }
+  if (node.isLeaf()) { return; }
+  foreach(LetterNode child, node.getChilds()) {
+    subtreeWords(child, name + QChar(child.getChar()), result);
+  }
+}
 
-    QTime now = QTime::currentTime();
+void IncrementalMatch::checkEarlyResult() {
+  /* detect if a scenario is dominant enough to provide a result before
+     the user has finished drawing: score gap with the following one must
+     be large enough, and it must be close to completing a word */
+  if (params.early_score_gap <= 0 || curve_count > 1) { return; }
 
-    if (startTime.msecsTo(now) > params.fallback_timeout) {
-      // timebox fallback time
-      // during tests it was always acceptable, but there is no upper bound on
-      // time required to process all possible scenarios, so let's stay on the safe side
-      logdebug("[fallbak: TIMEOUT!]");
-      break;
+  int best = -1, second = -1;
+  for(int i = 0; i < delayed_scenarios.size(); i ++) {
+    if (delayed_scenarios[i].dead || delayed_scenarios[i].isFinished()) { continue; }
+    float score = delayed_scenarios[i].getScore();
+    if (best < 0 || score > delayed_scenarios[best].getScore()) {
+      second = best;
+      best = i;
+    } else if (second < 0 || score > delayed_scenarios[second].getScore()) {
+      second = i;
     }
-
   }
-  foreach(Scenario s, list) {
-    result.append(MultiScenario(s));
+  if (best < 0) { return; }
+
+  DelayedScenario &ds = delayed_scenarios[best];
+  if (ds.getCount() < params.early_min_count) { return; }
+
+  float gap = (second >= 0)?(ds.getScore() - delayed_scenarios[second].getScore()):1;
+  if (gap < params.early_score_gap) { return; }
+
+  QString name = ds.getName();
+  if (name == early_prefix) { return; } // already sent
+
+  if (subtreeDepth(ds.getNode(), params.early_max_depth + 1) > params.early_max_depth) { return; }
+
+  QList<QPair<QString, QString> > words;
+  subtreeWords(ds.getNode(), name, words);
+  if (! words.size()) { return; }
+
+  provisional.clear();
+  early_words.clear();
+  for(int i = 0; i < words.size() && i < params.max_candidates; i ++) {
+    provisional.append(ScenarioDto(words[i].first, words[i].second, ds.getScore(), 0, false));
+    early_words.append(words[i].first);
   }
+  provisional_ready = true;
+  early_prefix = name;
+  st.st_early ++;
+
+  logdebug("[early] provisional result: %s (score=%.3f, gap=%.3f, words=%d)", QSTRING2PCHAR(name), ds.getScore(), gap, words.size());
+}
+
+bool IncrementalMatch::takeProvisional(QList<ScenarioDto> &result) {
+  if (! provisional_ready) { return false; }
+  result = provisional;
+  provisional_ready = false;
+  return true;
 }
 
 void IncrementalMatch::update_next_iteration_length(float aggressive) {
@@ -613,6 +1048,42 @@ void IncrementalMatch::update_next_iteration_length(float aggressive) {
   }
 }
 
+int IncrementalMatch::getBeamWidth(int max_width) {
+  /* current beam width, scaled to the given (configured) maximum */
+  if (params.beam_target_ms <= 0 || beam_width <= 0 || beam_width >= params.max_active_scenarios) { return max_width; }
+  return (int) (max_width * beam_width / params.max_active_scenarios + 0.5);
+}
+
+void IncrementalMatch::adjustBeamWidth(int elapsed_ms) {
+  /* feedback loop on measured iteration time: beam width is changed in
+     proportion to target / elapsed time ratio (with limited steps to
+     avoid oscillation) */
+  if (params.beam_target_ms <= 0) { return; }
+
+  float max_width = params.max_active_scenarios;
+  float min_width = qMin(params.beam_min_scenarios, params.max_active_scenarios);
+  if (beam_width <= 0) { beam_width = max_width; }
+
+  float ratio = (float) params.beam_target_ms / (elapsed_ms?elapsed_ms:1);
+  if (ratio > 1.25) { ratio = 1.25; } // grow slowly ...
+  if (ratio < 0.5) { ratio = 0.5; } // ... and shrink fast
+
+  float old_width = beam_width;
+  beam_width *= ratio;
+  if (beam_width > max_width) { beam_width = max_width; }
+  if (beam_width < min_width) { beam_width = min_width; }
+
+  int w = getBeamWidth(params.max_active_scenarios);
+  if (w < st.st_beam_width) { st.st_beam_down ++; }
+  if (w > st.st_beam_width) { st.st_beam_up ++; }
+  st.st_beam_width = w;
+  if (w < st.st_beam_min) { st.st_beam_min = w; }
+
+  if ((int) old_width != (int) beam_width) {
+    DBG("[beam] iteration time=%dms (target=%dms) -> width %.1f -> %.1f", elapsed_ms, params.beam_target_ms, old_width, beam_width);
+  }
+}
+
 static int compareFloat (const void * a, const void * b)
 {
   float a1 = *(float*)a;
@@ -624,19 +1095,22 @@ static int compareFloat (const void * a, const void * b)
 void IncrementalMatch::delayedScenariosFilter() {
   /* makes sure thats delayed scenario list stays at a reasoneable size & remove duplicate
      This is an adaptation from scenarioFilter() in curve_match.cpp */
+  PhaseTimer timer(st.st_t_filter);
 
   int nb = delayed_scenarios.size();
   float min_score = 0, min_score2 = 0;
-  if (nb > params.max_active_scenarios) {
+  int max_active = getBeamWidth(params.max_active_scenarios);
+  int max_active2 = getBeamWidth(params.max_active_scenarios2);
+  if (nb > max_active) {
     float* scores = new float[nb];
 
     for(int i = 0; i < delayed_scenarios.size(); i ++) {
       scores[i] = delayed_scenarios[i].getScore();
     }
     std::qsort(scores, nb, sizeof(float), compareFloat); // wtf ???
-    min_score = scores[nb - 1 - params.max_active_scenarios];
-    if (nb > params.max_active_scenarios2) {
-      min_score2 = scores[nb - 1 - params.max_active_scenarios2];
+    min_score = scores[nb - 1 - max_active];
+    if (nb > max_active2) {
+      min_score2 = scores[nb - 1 - max_active2];
     }
 
     delete[] scores;
@@ -688,6 +1162,7 @@ void IncrementalMatch::delayedScenariosFilter() {
 
 
 void IncrementalMatch::addPoint(Point point, int curve_id, int timestamp) {
+  TraceScope trace("addPoint", curve.size());
   bool first_point = false;
 
   if (curve.size() == 0) {
@@ -715,12 +1190,17 @@ void IncrementalMatch::endOneCurve(int curve_id) {
 }
 
 void IncrementalMatch::endCurve(int id) {
+  if (! deadline_timer.isValid()) { deadline_timer.start(); } // no earlier origin set by caller
   done = true;
   CurveMatch::endCurve(id);
   incrementalMatchUpdate(true);
   st.st_cputime = (int) (1000 * (getCPUTime() - start_cpu_time));
   st.st_time = (int) timer.elapsed();
-  logdebug("cputime=%d speed=%d treefile=%s", st.st_cputime, st.st_speed, QSTRING2PCHAR(treeFile));
+  logdebug("cputime=%d speed=%d treefile=%s", st.st_cputime, st.st_speed, QSTRING2PCHAR(engine -> getTreeFile()));
+  if (deadline > 0) {
+    logdebug("deadline=%dms elapsed=%dms truncated=%d", deadline, (int) deadline_timer.elapsed(), st.st_truncated);
+  }
+  deadline_timer.invalidate(); // next gesture
 }
 
 #endif /* INCREMENTAL */
@@ -16,18 +16,46 @@
 #include "tree.h"
 
 #include <QElapsedTimer>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QSemaphore>
+#include <QSet>
+#include <QVector>
+#include <QStringList>
 
 /* A delayed scenario is a scenario which childs can not be evaluated right now because
    the user has only drawn a small part of the gesture (mono or multi-touch), so we
    have to wait until he draws more before evaluating child scenarios
    -> this used for incremental mode */
 
-class NextLetter {
+/* child letters table: word tree letters are 'a'-'z' (stored as 96 + n, cf.
+   node_t in tree.h), so pending child letters fit in a 32 bits mask.
+   Length thresholds (min & max for each curve) are stored in the order of
+   letters at creation time. With a single curve they are stored inline
+   (there is room for all letters), so copying a delayed scenario needs no
+   allocation. With several curves they are stored in an implicitly shared
+   vector which is only copied when a threshold is updated (retry) */
+#define NEXT_MAX_LETTERS 31
+#define NEXT_LETTER_BIT(letter) ((letter) - 96)
+
+class NextLetters {
+ private:
+  int length[2 * NEXT_MAX_LETTERS]; // single curve
+  QVector<int> length_multi; // multi-curve
+  int index(int bit) const { return 2 * curve_count * __builtin_popcount(all & ((1U << bit) - 1)); }
+
  public:
-  LetterNode letter_node;
-  QList<int> next_length;
-  NextLetter(LetterNode);
-  NextLetter();
+  quint32 mask; // child letters still to be evaluated
+  quint32 all; // child letters at creation time (used to find thresholds index)
+  int curve_count;
+
+  NextLetters() : mask(0), all(0), curve_count(0) {};
+  void clear() { mask = all = 0; length_multi.clear(); }
+  void setCurveCount(int curve_count);
+  const int* getLengths(int bit) const;
+  int* updateLengths(int bit); // same as getLengths() but thresholds can be modified
 };
 
 class DelayedScenario {
@@ -38,18 +66,26 @@ class DelayedScenario {
   int curve_count;
   Params *params;
   QuickKeys *keys;
+  MultiContext *context;
   QSharedPointer<MultiScenario> multi_p;
   QSharedPointer<Scenario> single_p;
+  MemStats *mem; // memory accounting
+  void memAdd(MemStats *mem);
 
  public:
   bool dead;
-  QHash<unsigned char, NextLetter> next;
+  NextLetters next;
   bool nextOk;
 
-  DelayedScenario(LetterTree *tree, QuickKeys *keys, QuickCurve *curves, Params *params);
+  int birth; // generation (iteration) when scenario has entered the beam (-1 = not yet)
+  int death; // generation when it has left the beam (only for snapshot copies)
+
+  DelayedScenario(LetterTree *tree, QuickKeys *keys, QuickCurve *curves, Params *params, MultiContext *context);
   DelayedScenario(const DelayedScenario &from);
   DelayedScenario(const MultiScenario &from);
-  DelayedScenario(const Scenario &from);
+  DelayedScenario(const Scenario &from, MultiContext *context);
+  DelayedScenario(MultiScenarioHandle from);
+  DelayedScenario(ScenarioHandle from, MultiContext *context);
   DelayedScenario& operator=(const DelayedScenario &from);
   ~DelayedScenario();
 
@@ -68,6 +104,7 @@ class DelayedScenario {
 
   bool operator<(const DelayedScenario &other) const;
   void die() { dead = true; }
+  DelayedScenario frozenCopy(int death);
 
   void updateNextLength();
   void getChildsIncr(QList<DelayedScenario> &childs, bool finished, stats_t &st, bool recursive = true, float aggressive = 0);
@@ -77,13 +114,50 @@ class DelayedScenario {
 
   void display(char *prefix = NULL);
 
-  void deepDive(QList<Scenario> &result);
+  void deepDive(QList<Scenario> &result, float min_score = 0., const QSet<int> *filter = NULL);
+  int getMemory();
+};
+
+/* fallback work shared between worker threads: delayed scenarios are
+   handed out best first, and all results go to a bounded min-heap whose
+   lowest score is used as a cutoff for subsequent deep dives */
+class FallbackJob {
+ private:
+  QMutex mutex;
+  QList<Scenario> heap; // worst candidate first
+  int max_size;
+  QAtomicInt next_index;
+  const QList<DelayedScenario> *ds_list;
+  const QSet<QString> *dedupe;
+  int min_length;
+  const QSet<int> *filter;
+  QElapsedTimer timer;
+  int timeout;
+
+  float cutoff();
+  void add(QList<Scenario> &list);
+
+ public:
+  QAtomicInt timed_out;
+
+  FallbackJob(const QList<DelayedScenario> *ds_list, const QSet<QString> *dedupe, int min_length, int max_size, int timeout, const QSet<int> *filter = NULL);
+  void work();
+  QList<Scenario> getResult();
+};
+
+class FallbackWorker : public QRunnable {
+ private:
+  FallbackJob *job;
+  QSemaphore *done;
+ public:
+  FallbackWorker(FallbackJob *job, QSemaphore *done) : job(job), done(done) {};
+  void run() { job->work(); done->release(); }
 };
 
 class IncrementalMatch : public CurveMatch {
  protected:
   void incrementalMatchBegin();
-  void incrementalMatchUpdate(bool finished, float aggressive = 0);
+  bool incrementalMatchUpdate(bool finished, float aggressive = 0, bool speculative = false);
   QString getLengthStr();
 
   void update_next_iteration_length(float aggressive);
@@ -102,17 +176,51 @@ class IncrementalMatch : public CurveMatch {
 
   QList<DelayedScenario> *delayed_scenarios_p;
 
+  /* fallback snapshots are just generation numbers: scenarios are shared with the live
+     beam, and only those which have left the beam since the oldest snapshot are kept
+     (without their "next" tables) in the graveyard list */
+  int generation;
   int last_snapshot_count;
-  QList< QList<DelayedScenario> *> ds_snapshots;
+  QList<int> ds_snapshots;
+  QList<DelayedScenario> ds_graveyard;
+  QList<DelayedScenario> getSnapshot(int gen);
   void fallback(QList<ScenarioType> &result);
 
+  QAtomicInt *interrupt_flag;
+  bool interrupted();
+
+  QElapsedTimer deadline_timer; // started when user has finished drawing (cf. setDeadlineStart)
+  int remainingTime();
+  float budgetLeft();
+
+  /* early (provisional) result while user is still drawing */
+  QString early_prefix; // leading scenario of last provisional result (sent only once)
+  QStringList early_words; // names in last provisional result
+  QList<ScenarioDto> provisional;
+  bool provisional_ready;
+  void checkEarlyResult();
+
+  /* adaptive beam width: max_active_scenarios is lowered if iterations take
+     too long (loaded or throttled CPU), and raised again when possible.
+     This is kept from one gesture to the next */
+  float beam_width;
+  int getBeamWidth(int max_width);
+  void adjustBeamWidth(int elapsed_ms);
+
+  /* dictionary filter for final pass & fallback (see CurveMatch::dictionaryFilter) */
+  QSet<int> final_nodes;
+  bool final_filter;
+
  public:
-  IncrementalMatch();
+  IncrementalMatch(QSharedPointer<MatchEngine> engine = QSharedPointer<MatchEngine>());
   virtual ~IncrementalMatch();
   virtual void addPoint(Point point, int curve_id, int timestamp = -1);
   virtual void endOneCurve(int curve_id);
   virtual void endCurve(int id);
-  void aggressiveMatch();
+  bool aggressiveMatch(float aggressive = 1.0);
+  bool takeProvisional(QList<ScenarioDto> &result);
+  void setInterruptFlag(QAtomicInt *flag) { interrupt_flag = flag; }
+  void setDeadlineStart(const QElapsedTimer &start) { deadline_timer = start; } // otherwise deadline starts with endCurve()
 };
 
 #endif /* INCREMENTAL */
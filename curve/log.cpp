@@ -1,22 +1,254 @@
 #include <QFile>
 #include <QString>
-#include <QTextStream>
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QAtomicInt>
+#include <QSemaphore>
+#include <QElapsedTimer>
+
+#include <stdlib.h>
+#include <string.h>
 
 #include "log.h"
 
-static QString logFile;
+/* asynchronous log sink
+   - producers (any thread) claim a slot in a bounded multi-producer queue
+     with a compare-and-swap, copy their line and publish it (no lock, no
+     system call)
+   - a background thread is woken up when the queue becomes non-empty, waits
+     a little so lines are batched, and writes everything to the log file
+     (opened once per batch instead of once per line) and stderr. It sleeps
+     as long as nothing is logged
+   - if the queue is full, the producer flushes it by itself (so nothing is
+     lost, but this is slow)
+   Queue algorithm: each slot has a sequence number telling if it is free for
+   a given producer position or ready for the consumer */
+
+#define LOG_QUEUE_SIZE 512 // must be a power of 2
+#define LOG_QUEUE_MASK (LOG_QUEUE_SIZE - 1)
+#define LOG_FLUSH_DELAY 50 // ms (batching)
+
+#define LOG_TYPE_LINE 0
+#define LOG_TYPE_DATA 1
+
+/* binary record header (followed by payload) */
+typedef struct {
+  unsigned char magic; // 'R'
+  unsigned char level;
+  unsigned char type; // LOG_TYPE_*
+  unsigned char reserved;
+  quint32 ts; // ms since process start (monotonic)
+  quint32 len;
+} log_record_t;
+
+int log_level = LOG_DEBUG;
+
+class LogSlot {
+ public:
+  QAtomicInt seq;
+  int level;
+  int type;
+  int ts;
+  int len;
+  char text[LOG_LINE_SIZE];
+  QByteArray data; // only for LOG_TYPE_DATA
+};
+
+class LogQueue {
+ public:
+  LogSlot ring[LOG_QUEUE_SIZE];
+  QAtomicInt head; // next position for producers
+  QAtomicInt outputs; // 0 = no output: logging is a no-op
+  QAtomicInt started; // flush thread has been started
+  QAtomicInt pending; // records published since flush thread last woke up
+  QSemaphore wakeup; // released when pending goes from 0 to 1
+  QElapsedTimer clock;
+
+  /* consumer side: everything below is protected by mutex */
+  QMutex mutex;
+  int tail;
+  QString file_name;
+  bool to_stderr;
+  bool binary;
+
+  LogQueue();
+  bool push(int level, int type, const char *text, const QByteArray *data);
+  void drain();
+  void updateOutputs() { outputs = (to_stderr || ! file_name.isEmpty())?1:0; }
+};
+
+static LogQueue &queue = *(new LogQueue()); // never deleted: flush thread may still run during exit
+
+LogQueue::LogQueue() {
+  for(int i = 0; i < LOG_QUEUE_SIZE; i ++) { ring[i].seq = i; }
+  head = 0;
+  tail = 0;
+  started = 0;
+  pending = 0;
+  to_stderr = true;
+  binary = false;
+  clock.start();
+  updateOutputs();
+}
+
+bool LogQueue::push(int level, int type, const char *text, const QByteArray *data) {
+  int pos = head.loadAcquire();
+  LogSlot *slot;
+  forever {
+    slot = &ring[pos & LOG_QUEUE_MASK];
+    int dif = slot->seq.loadAcquire() - pos;
+    if (dif == 0) {
+      if (head.testAndSetOrdered(pos, pos + 1)) { break; } // slot is ours
+      pos = head.loadAcquire();
+    } else if (dif < 0) {
+      return false; // full (consumer has not released this slot yet)
+    } else {
+      pos = head.loadAcquire(); // another producer got it first
+    }
+  }
+
+  slot->level = level;
+  slot->type = type;
+  slot->ts = (int) clock.elapsed();
+  if (type == LOG_TYPE_DATA) {
+    slot->data = *data;
+    slot->len = data->size();
+  } else if (data) {
+    slot->data = *data; // long line (cf. log_string)
+    slot->len = data->size();
+  } else {
+    int len = strlen(text);
+    if (len >= LOG_LINE_SIZE) { len = LOG_LINE_SIZE - 1; }
+    memcpy(slot->text, text, len);
+    slot->text[len] = '\0';
+    slot->len = len;
+  }
+  slot->seq.storeRelease(pos + 1); // publish
+  if (pending.fetchAndAddOrdered(1) == 0) { wakeup.release(); }
+  return true;
+}
+
+void LogQueue::drain() {
+  /* write all published records (mutex must be held) */
+  QFile file(file_name);
+  bool file_ok = false;
+  bool first = true;
+
+  forever {
+    LogSlot *slot = &ring[tail & LOG_QUEUE_MASK];
+    if (slot->seq.loadAcquire() != tail + 1) { break; } // empty (or still being written)
+
+    if (first && ! file_name.isEmpty()) { file_ok = file.open(QIODevice::Append); }
+    first = false;
+
+    const char *payload = (slot->data.isNull())?slot->text:slot->data.constData();
+    if (to_stderr && slot->type == LOG_TYPE_LINE) { cerr << payload << endl; }
+    if (file_ok) {
+      if (binary) {
+	log_record_t rec;
+	rec.magic = 'R';
+	rec.level = slot->level;
+	rec.type = slot->type;
+	rec.reserved = 0;
+	rec.ts = slot->ts;
+	rec.len = slot->len;
+	file.write((const char*) &rec, sizeof(rec));
+	file.write(payload, slot->len);
+      } else {
+	file.write(payload, slot->len);
+	file.write("\n", 1);
+      }
+    }
+
+    slot->data = QByteArray(); // don't keep large buffers alive until the slot is reused
+    slot->seq.storeRelease(tail + LOG_QUEUE_SIZE); // slot is free for next round
+    tail ++;
+  }
+
+  if (file_ok) { file.close(); }
+}
 
-void log_line(char* txt) {
-  if (! logFile.isNull()) {
-    QFile file(logFile);
-    if (file.open(QIODevice::Append)) {
-      QTextStream out(&file);
-      out << txt << "\n";
+class LogThread : public QThread {
+ protected:
+  void run() {
+    forever {
+      queue.wakeup.acquire();
+      msleep(LOG_FLUSH_DELAY);
+      queue.pending.fetchAndStoreOrdered(0); // records published after this will wake us up again
+      log_flush();
     }
-    file.close();
   }
+};
+
+static void log_exit() {
+  log_flush();
+}
+
+static void log_push(int level, int type, const char *text, const QByteArray *data) {
+  if (! queue.outputs.loadAcquire()) { return; }
+
+  if (! queue.started.loadAcquire() && queue.started.testAndSetOrdered(0, 1)) {
+    atexit(log_exit);
+    (new LogThread()) -> start(); // never deleted: it runs until process exit
+  }
+
+  while (! queue.push(level, type, text, data)) {
+    // queue is full: flush it ourselves (or wait if it is already in progress)
+    if (queue.mutex.tryLock()) {
+      queue.drain();
+      queue.mutex.unlock();
+    } else {
+      QThread::yieldCurrentThread();
+    }
+  }
+}
+
+void log_line(const char* txt, int level) {
+  if (level > log_level) { return; }
+  log_push(level, LOG_TYPE_LINE, txt, NULL);
+}
+
+void log_string(const QString &str, int level) {
+  if (level > log_level) { return; }
+  QByteArray data = str.toUtf8();
+  if (data.size() < LOG_LINE_SIZE) {
+    log_push(level, LOG_TYPE_LINE, data.constData(), NULL);
+  } else {
+    log_push(level, LOG_TYPE_LINE, NULL, &data);
+  }
+}
+
+void log_data(const QByteArray &data, int level) {
+  if (level > log_level) { return; }
+  log_push(level, LOG_TYPE_DATA, NULL, &data);
+}
+
+void log_flush() {
+  QMutexLocker locker(&queue.mutex);
+  queue.drain();
 }
 
 void log_setfile(QString fname) {
-  logFile = fname;
+  QMutexLocker locker(&queue.mutex);
+  queue.drain(); // pending lines go to previous file
+  queue.file_name = fname;
+  queue.updateOutputs();
+}
+
+void log_setlevel(int level) {
+  log_level = level;
+}
+
+void log_setstderr(bool value) {
+  QMutexLocker locker(&queue.mutex);
+  queue.drain();
+  queue.to_stderr = value;
+  queue.updateOutputs();
+}
+
+void log_setbinary(bool value) {
+  QMutexLocker locker(&queue.mutex);
+  queue.drain();
+  queue.binary = value;
 }
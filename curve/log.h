@@ -2,29 +2,50 @@
 #define LOG_H
 
 #include <iostream>
+#include <QString>
+#include <QByteArray>
 #include "time.h"
 
 using namespace std;
 
 /* does not like threads ? #define logdebug( ... ) { qDebug( __VA_ARGS__ ); } */
 
-void log_line(char*);
+/* log lines are queued (lock-free) and written by a background thread, so
+   logging only costs a snprintf() on caller side (and nothing at all if the
+   level is disabled or there is no output) */
+
+#define LOG_ERROR 0
+#define LOG_INFO 1
+#define LOG_DEBUG 2
+
+#define LOG_LINE_SIZE 512
+
+extern int log_level;
+
+void log_line(const char*, int level = LOG_DEBUG);
+void log_string(const QString &str, int level = LOG_DEBUG); // same as log_line() without line length limit
+void log_data(const QByteArray &data, int level = LOG_INFO); // large records (e.g. JSON dumps)
 void log_setfile(QString);
+void log_setlevel(int level);
+void log_setstderr(bool value); // also write log lines to stderr (default: true)
+void log_setbinary(bool value); // compact binary records (cf. tools/logdecode.py)
+void log_flush(); // synchronous flush (e.g. before exit)
 
 #define QSTRING2PCHAR(x) ((x).toUtf8().constData())
 #define QSTRING2PUCHAR(x) (unsigned char*) ((x).toUtf8().constData())
 
-#define logdebug( ... ) { char tmp[512]; snprintf(tmp, sizeof(tmp) - 1, __VA_ARGS__); cerr << tmp << endl; log_line(tmp); }
+#define logdebug( ... ) { if (log_level >= LOG_DEBUG) { char tmp[LOG_LINE_SIZE]; snprintf(tmp, sizeof(tmp) - 1, __VA_ARGS__); log_line(tmp); } }
 
-#define logdebug_ts( ... ) { time_t now = time(NULL); char tmp[512] = ""; \
+#define logdebug_ts( ... ) { if (log_level >= LOG_DEBUG) { \
+    time_t now = time(NULL); char tmp[LOG_LINE_SIZE] = "";	\
     strcat(tmp, "["); \
     strcat(tmp, ctime(&now)); \
     tmp[strlen(tmp) - 1] = '\0'; \
     strcat(tmp, "] "); \
     int l = strlen(tmp) ; \
     snprintf(tmp + l, sizeof(tmp) - l - 1, __VA_ARGS__);	\
-    cerr << tmp << endl; log_line(tmp); }
+    log_line(tmp); } }
 
-#define logdebug_qstring(str) { cerr << QSTRING2PCHAR(str) << endl; }
+#define logdebug_qstring(str) { if (log_level >= LOG_DEBUG) { log_string(str); } }
 
 #endif /* LOG_H */
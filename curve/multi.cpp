@@ -10,19 +10,12 @@
 #define FOREACH_ALL_SCENARIOS(var, code) for(QList<QSharedPointer<Scenario> >::const_iterator it = scenarios.begin(); it != scenarios.end(); ++ it) { Scenario *var = it->data(); code; }
 #define S(curve_id) (scenarios[curve_id].data())
 
-int MultiScenario::global_id = -1;
-QList<Scenario> MultiScenario::scenario_root;
-
-void MultiScenario::init() {
-  MultiScenario::global_id = 1;
-  MultiScenario::scenario_root.clear();
-}
-
-MultiScenario::MultiScenario(LetterTree *tree, QuickKeys *keys, QuickCurve *curves, Params *params) {
+MultiScenario::MultiScenario(LetterTree *tree, QuickKeys *keys, QuickCurve *curves, Params *params, MultiContext *context) {
   this -> node = tree -> getRoot();
   this -> keys = keys;
   this -> curves = curves;
   this -> params = params;
+  this -> context = context;
 
   debug = finished = false;
   count = 0;
@@ -40,15 +33,21 @@ MultiScenario::MultiScenario(LetterTree *tree, QuickKeys *keys, QuickCurve *curv
   zombie = false;
 
   id = 0;
-  MultiScenario::init();
+  context -> init();
+
+  mem = params?params->glob_mem:NULL;
+  mem_size = mem?getMemory():0;
+  if (mem) { mem->add(MEM_MULTI, mem_size); }
 }
 
 MultiScenario::MultiScenario(const MultiScenario &from) {
   copy_from(from);
+  if (mem) { mem->add(MEM_MULTI, mem_size); }
 }
 
-MultiScenario::MultiScenario(const Scenario &from) {
+MultiScenario::MultiScenario(const Scenario &from, MultiContext *context) {
   // promote a standard scenario to a multi-touch one
+  this -> context = context;
   params = from.params;
   curves = from.curve; /* let's assume this was a pointer to a properly size array (which is the case when called from incr_match.cpp */
   params = from.params;
@@ -86,19 +85,26 @@ MultiScenario::MultiScenario(const Scenario &from) {
   scenarios.clear();
   scenarios.append(QSharedPointer<Scenario> (new Scenario(from)));
 
-  id = (MultiScenario::global_id ++);
+  id = (context -> global_id ++);
   zombie = false;
+
+  mem = from.mem;
+  mem_size = mem?getMemory():0;
+  if (mem) { mem->add(MEM_MULTI, mem_size); }
 }
 
 MultiScenario& MultiScenario::operator=(const MultiScenario &from) {
   // overriden copy to take care of dynamically allocated stuff
+  if (mem) { mem->remove(MEM_MULTI, mem_size); }
   delete[] history;
   delete[] letter_history;
   copy_from(from);
+  if (mem) { mem->add(MEM_MULTI, mem_size); }
   return *this;
 }
 
 void MultiScenario::copy_from(const MultiScenario &from) {
+  context = from.context;
   params = from.params;
   curves = from.curves;
   params = from.params;
@@ -132,13 +138,27 @@ void MultiScenario::copy_from(const MultiScenario &from) {
 
   id = from.id;
   zombie = from.zombie;
+
+  mem = from.mem;
+  mem_size = mem?getMemory():0;
 }
 
 MultiScenario::~MultiScenario() {
+  if (mem) { mem->remove(MEM_MULTI, mem_size); }
   delete[] history;
   delete[] letter_history;
 }
 
+int MultiScenario::getMemory(bool all) const {
+  /* approximate memory used by a multi-touch scenario (and optionally by
+     its sub-scenarios, which may be shared with other instances) */
+  int size = sizeof(MultiScenario) + (count + 1) * sizeof(history_t) + count + 2;
+  if (all) {
+    FOREACH_ALL_SCENARIOS(s, size += s->getMemory());
+  }
+  return size;
+}
+
 QString MultiScenario::getId() const {
   QString ret;
   QTextStream ts(& ret);
@@ -171,13 +191,13 @@ void MultiScenario::addSubScenarios() {
 
     // reuse scenario root for cache sharing
     int idx = scenarios.size();
-    if (idx < MultiScenario::scenario_root.size()) {
-      s = new Scenario(MultiScenario::scenario_root[idx]);
+    if (idx < context -> scenario_root.size()) {
+      s = new Scenario(context -> scenario_root[idx]);
     } else {
       s = new Scenario((LetterTree*) NULL /* no more needed? */, keys, &(curves[scenarios.size()]), params);
       s->setDebug(debug);
       s->setCache(true); // improve performance for scenario reuse
-      MultiScenario::scenario_root.append(*s);
+      context -> scenario_root.append(*s);
     }
 
     scenarios.append(QSharedPointer<Scenario>(s));
@@ -185,6 +205,17 @@ void MultiScenario::addSubScenarios() {
 }
 
 bool MultiScenario::childScenario(LetterNode &childNode, QList<MultiScenario> &result, stats_t &st, int filter_curve_id, bool incremental) {
+  /* same as below, but return copies of child scenarios (for callers that store scenarios by value) */
+  QList<MultiScenarioHandle> childs;
+  bool ret = childScenario(childNode, childs, st, filter_curve_id, incremental);
+  foreach(MultiScenarioHandle h, childs) { result.append(*h); }
+  return ret;
+}
+
+bool MultiScenario::childScenario(LetterNode &childNode, QList<MultiScenarioHandle> &result, stats_t &st, int filter_curve_id, bool incremental) {
+  /* child multi-scenarios are allocated once and returned as shared handles, and
+     they share all their sub-scenarios with their parent (except the one which
+     has just been extended) */
   unsigned char letter = childNode.getChar();
 
   char quadrant = keys->quadrant(letter);
@@ -254,14 +285,14 @@ bool MultiScenario::childScenario(LetterNode &childNode, QList<MultiScenario> &r
       chld_hasPayload = true;
     }
 
-    QList<Scenario> childs;
+    QList<ScenarioHandle> childs;
 
     int scenario_count = scenario->getCount();
     if (scenario_count > 0 && letter == scenario->getNameCharPtr()[scenario_count - 1]) {
       DBG("%s: Dual letter '%c'", QSTRING2PCHAR(getId()), letter);
       // handle multi-scenarios that lead to dual-letter single scenarios
       // @todo move this into Scenario::childScenario to handle dual-letter in a more general way and support dual-letter user hints
-      childs.append(*scenario);
+      childs.append(scenarios[curve_id]);
       zombie = false;
       zombie_if_finished = false;
 
@@ -272,16 +303,22 @@ bool MultiScenario::childScenario(LetterNode &childNode, QList<MultiScenario> &r
 
     // @todo optional zone notion. e.g. left & right half keyboard. A curve is contained in a single region (should reduce tree width)
 
-    foreach(Scenario child, childs) {
-      child.setQuadrant(quadrant);
+    foreach(ScenarioHandle child_p, childs) {
+      if (child_p->getQuadrant() != quadrant) {
+	// child handles may be shared (child cache, dual letter): copy before updating
+	child_p = ScenarioHandle(new Scenario(*child_p));
+	child_p->setQuadrant(quadrant);
+      }
+      Scenario &child = *child_p;
 
       int new_ts = child.getTimestamp();
       if (new_ts < ts - params->multi_max_time_rewind) { continue; } // we accept small infraction with events ordering :-)
 
       bool endScenario = child.isFinished();
 
-      MultiScenario new_ms(*this);
-      new_ms.scenarios[curve_id] = QSharedPointer<Scenario>(new Scenario(child)); // useless copy -> @todo Scenario::childScenario return pointers to dynamically allocated objects
+      MultiScenarioHandle new_ms_p(new MultiScenario(*this)); // only copy history, sub-scenarios are shared
+      MultiScenario &new_ms = *new_ms_p;
+      new_ms.scenarios[curve_id] = child_p;
       new_ms.node = childNode;
       new_ms.history[count].curve_id = curve_id;
       new_ms.history[count].curve_index = child.getCurveIndex();
@@ -293,12 +330,12 @@ bool MultiScenario::childScenario(LetterNode &childNode, QList<MultiScenario> &r
       new_ms.dist_sqr = dist_sqr + child.getDistSqr() - scenario->getDistSqr();
       new_ms.dist = sqrt(new_ms.dist_sqr / (count + 1));
       new_ms.ts = new_ts;
-      new_ms.id = (MultiScenario::global_id ++);
+      new_ms.id = (context -> global_id ++);
       if (endScenario && zombie_if_finished) { new_ms.zombie = true; } // @todo check again. it probably does not cover all cases.
 
       /* if (curve_count >= 2) */ { DBG("[MULTI] -> child scenario: %s [end=%d, zombie=%d]", QSTRING2PCHAR(new_ms.getId()), endScenario, new_ms.zombie); }
 
-      result.append(new_ms);
+      result.append(new_ms_p);
     }
 
   }
@@ -316,6 +353,10 @@ void MultiScenario::nextKey(QList<MultiScenario> &result, stats_t &st) {
   }
 }
 
+QList<LetterNode> MultiScenario::getNextKeys() {
+  return node.getChilds();
+}
+
 bool MultiScenario::operator<(const MultiScenario &other) const {
   return this -> getScore() < other.getScore();
 }
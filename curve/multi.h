@@ -28,6 +28,20 @@ typedef struct {
 class DelayedScenario;
 #endif /* INCREMENTAL */
 
+class MultiScenario;
+typedef QSharedPointer<MultiScenario> MultiScenarioHandle;
+
+/* matching context shared by all multi-touch scenarios of a session
+   (this used to be static class members, which prevented concurrent sessions) */
+class MultiContext {
+ public:
+  int global_id; /* track current global id */
+  QList<Scenario> scenario_root;
+
+  MultiContext() : global_id(1) {};
+  void init() { global_id = 1; scenario_root.clear(); }
+};
+
 /* a "MultiScenario" is a scenario that aggregate multiple scenarios (one for
    each curve drawn in a multi-touch context) */
 class MultiScenario {
@@ -39,6 +53,7 @@ class MultiScenario {
   QuickKeys *keys;
   QuickCurve *curves;
   Params *params;
+  MultiContext *context;
 
   // MultiScenario instances can have child which share basic scenarios with
   // their parent. To avoid unnecessary copying use QT smart pointers
@@ -60,21 +75,22 @@ class MultiScenario {
   history_t *history;
   unsigned char *letter_history;
 
+  MemStats *mem; // memory accounting
+  int mem_size;
+
   void copy_from(const MultiScenario &from);
 
   void addSubScenarios();
 
-  static int global_id; /* yuck global variable to track current global id */
-  static QList<Scenario> scenario_root;
-
  public:
-  MultiScenario(LetterTree *tree, QuickKeys *keys, QuickCurve *curves, Params *params);
+  MultiScenario(LetterTree *tree, QuickKeys *keys, QuickCurve *curves, Params *params, MultiContext *context);
   MultiScenario(const MultiScenario &from);
-  MultiScenario(const Scenario &from);
+  MultiScenario(const Scenario &from, MultiContext *context);
   MultiScenario& operator=( const MultiScenario &from );
   ~MultiScenario();
 
   bool childScenario(LetterNode &child, QList<MultiScenario> &result, stats_t &st, int curve_id = -1, bool incremental = false);
+  bool childScenario(LetterNode &child, QList<MultiScenarioHandle> &result, stats_t &st, int curve_id = -1, bool incremental = false);
   void nextKey(QList<MultiScenario> &result, stats_t &st);
   QList<LetterNode> getNextKeys();
 
@@ -104,9 +120,9 @@ class MultiScenario {
   QString getId() const;
   bool nextLength(unsigned char next_letter, int curve_id, int &min, int &max);
   float getScoreV1() const;
+  int getMemory(bool all = false) const;
 
   static void sortCandidates(QList<MultiScenario *> candidates, Params &params, int debug);
-  static void init();
 
   float getNewDistance();
 
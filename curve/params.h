@@ -3,6 +3,8 @@
 #ifndef PARAMS_H
 #define PARAMS_H
 
+class MemStats;
+
 class Params {
  public:
   /* BEGIN DECL */
@@ -20,7 +22,10 @@ class Params {
   float atp_pt_61;
   int atp_threshold;
   float bad_tangent_score;
+  int beam_min_scenarios;
+  int beam_target_ms;
   int bjr_min_turn;
+  float bucket_length_ratio;
   int cat_window;
   float cls_distance_max_ratio;
   int cls_enable;
@@ -55,6 +60,9 @@ class Params {
   int dst_x_max;
   int dst_y_add;
   int dst_y_max;
+  int early_max_depth;
+  int early_min_count;
+  float early_score_gap;
   int end_scenario_wait;
   int error_correct;
   int error_ignore_count;
@@ -62,6 +70,7 @@ class Params {
   int fallback_min_length;
   int fallback_snapshot_queue;
   int fallback_start_count;
+  int fallback_threads;
   int fallback_timeout;
   float final_coef_misc;
   float final_coef_turn;
@@ -97,12 +106,14 @@ class Params {
   int hint_v_minturn2;
   int hint_v_range;
   int hints_master_switch;
+  float incr_idle_aggressive;
   int incr_retry;
   int incremental_index_gap;
   int incremental_length_lag;
   int inf_max;
   int inf_min;
   int inter_pt_min_dist;
+  int key_pass;
   float key_shift_ema_coef;
   int key_shift_enable;
   float key_shift_ratio;
@@ -121,6 +132,7 @@ class Params {
   int max_segment_length;
   int max_star_index;
   int max_turn_index_gap;
+  int mem_stats;
   int min_turn_index_gap;
   int min_turn_index_gap_st;
   int multi_dot_threshold;
@@ -158,6 +170,9 @@ class Params {
   float scaling_size_pow;
   float score_pow;
   float sharp_turn_penalty;
+  int shortlist_min_words;
+  int shortlist_samples;
+  int shortlist_size;
   int slow_down_max_turn;
   float slow_down_ratio;
   float small_segment_min_score;
@@ -220,6 +235,7 @@ class Params {
   float ut_score;
   int ut_total;
   int ut_turn;
+  int warm_restore;
   float weight_cos;
   float weight_curve;
   float weight_distance;
@@ -233,6 +249,7 @@ class Params {
 
   // stuff some "global variables" in params structure (fugly !)
   float glob_size_ratio;
+  MemStats *glob_mem; // memory accounting for current matching session
 };
 #endif /* PARAMS_H */
 
@@ -255,7 +272,10 @@ static Params default_params = {
   0.79, // atp_pt_61
   8, // atp_threshold
   0.03, // bad_tangent_score
+  10, // beam_min_scenarios
+  0, // beam_target_ms
   120, // bjr_min_turn
+  0.0, // bucket_length_ratio
   12, // cat_window
   0.8, // cls_distance_max_ratio
   1, // cls_enable
@@ -290,6 +310,9 @@ static Params default_params = {
   97, // dst_x_max
   40, // dst_y_add
   124, // dst_y_max
+  2, // early_max_depth
+  4, // early_min_count
+  0.0, // early_score_gap
   100, // end_scenario_wait
   1, // error_correct
   5, // error_ignore_count
@@ -297,6 +320,7 @@ static Params default_params = {
   4, // fallback_min_length
   3, // fallback_snapshot_queue
   5, // fallback_start_count
+  1, // fallback_threads
   100, // fallback_timeout
   1.0, // final_coef_misc
   29.0, // final_coef_turn
@@ -332,12 +356,14 @@ static Params default_params = {
   16, // hint_v_minturn2
   7, // hint_v_range
   1, // hints_master_switch
+  0.0, // incr_idle_aggressive
   50, // incr_retry
   5, // incremental_index_gap
   100, // incremental_length_lag
   120, // inf_max
   20, // inf_min
   50, // inter_pt_min_dist
+  1, // key_pass
   0.005, // key_shift_ema_coef
   0, // key_shift_enable
   1.0, // key_shift_ratio
@@ -356,6 +382,7 @@ static Params default_params = {
   25, // max_segment_length
   8, // max_star_index
   7, // max_turn_index_gap
+  0, // mem_stats
   2, // min_turn_index_gap
   3, // min_turn_index_gap_st
   25, // multi_dot_threshold
@@ -393,6 +420,9 @@ static Params default_params = {
   0.9, // scaling_size_pow
   1.0, // score_pow
   0.6, // sharp_turn_penalty
+  50000, // shortlist_min_words
+  16, // shortlist_samples
+  0, // shortlist_size
   3, // slow_down_max_turn
   1.15, // slow_down_ratio
   0.2, // small_segment_min_score
@@ -455,6 +485,7 @@ static Params default_params = {
   0.08, // ut_score
   80, // ut_total
   15, // ut_turn
+  1, // warm_restore
   2.0, // weight_cos
   6.0, // weight_curve
   2.0, // weight_distance
@@ -466,6 +497,7 @@ static Params default_params = {
 
   // global variables :-)
   0, // glob_size_ratio
+  0, // glob_mem
 };
 
 void Params::toJson(QJsonObject &json) const {
@@ -484,7 +516,10 @@ void Params::toJson(QJsonObject &json) const {
   json["atp_pt_61"] = atp_pt_61;
   json["atp_threshold"] = atp_threshold;
   json["bad_tangent_score"] = bad_tangent_score;
+  json["beam_min_scenarios"] = beam_min_scenarios;
+  json["beam_target_ms"] = beam_target_ms;
   json["bjr_min_turn"] = bjr_min_turn;
+  json["bucket_length_ratio"] = bucket_length_ratio;
   json["cat_window"] = cat_window;
   json["cls_distance_max_ratio"] = cls_distance_max_ratio;
   json["cls_enable"] = cls_enable;
@@ -519,6 +554,9 @@ void Params::toJson(QJsonObject &json) const {
   json["dst_x_max"] = dst_x_max;
   json["dst_y_add"] = dst_y_add;
   json["dst_y_max"] = dst_y_max;
+  json["early_max_depth"] = early_max_depth;
+  json["early_min_count"] = early_min_count;
+  json["early_score_gap"] = early_score_gap;
   json["end_scenario_wait"] = end_scenario_wait;
   json["error_correct"] = error_correct;
   json["error_ignore_count"] = error_ignore_count;
@@ -526,6 +564,7 @@ void Params::toJson(QJsonObject &json) const {
   json["fallback_min_length"] = fallback_min_length;
   json["fallback_snapshot_queue"] = fallback_snapshot_queue;
   json["fallback_start_count"] = fallback_start_count;
+  json["fallback_threads"] = fallback_threads;
   json["fallback_timeout"] = fallback_timeout;
   json["final_coef_misc"] = final_coef_misc;
   json["final_coef_turn"] = final_coef_turn;
@@ -561,12 +600,14 @@ void Params::toJson(QJsonObject &json) const {
   json["hint_v_minturn2"] = hint_v_minturn2;
   json["hint_v_range"] = hint_v_range;
   json["hints_master_switch"] = hints_master_switch;
+  json["incr_idle_aggressive"] = incr_idle_aggressive;
   json["incr_retry"] = incr_retry;
   json["incremental_index_gap"] = incremental_index_gap;
   json["incremental_length_lag"] = incremental_length_lag;
   json["inf_max"] = inf_max;
   json["inf_min"] = inf_min;
   json["inter_pt_min_dist"] = inter_pt_min_dist;
+  json["key_pass"] = key_pass;
   json["key_shift_ema_coef"] = key_shift_ema_coef;
   json["key_shift_enable"] = key_shift_enable;
   json["key_shift_ratio"] = key_shift_ratio;
@@ -585,6 +626,7 @@ void Params::toJson(QJsonObject &json) const {
   json["max_segment_length"] = max_segment_length;
   json["max_star_index"] = max_star_index;
   json["max_turn_index_gap"] = max_turn_index_gap;
+  json["mem_stats"] = mem_stats;
   json["min_turn_index_gap"] = min_turn_index_gap;
   json["min_turn_index_gap_st"] = min_turn_index_gap_st;
   json["multi_dot_threshold"] = multi_dot_threshold;
@@ -622,6 +664,9 @@ void Params::toJson(QJsonObject &json) const {
   json["scaling_size_pow"] = scaling_size_pow;
   json["score_pow"] = score_pow;
   json["sharp_turn_penalty"] = sharp_turn_penalty;
+  json["shortlist_min_words"] = shortlist_min_words;
+  json["shortlist_samples"] = shortlist_samples;
+  json["shortlist_size"] = shortlist_size;
   json["slow_down_max_turn"] = slow_down_max_turn;
   json["slow_down_ratio"] = slow_down_ratio;
   json["small_segment_min_score"] = small_segment_min_score;
@@ -684,6 +729,7 @@ void Params::toJson(QJsonObject &json) const {
   json["ut_score"] = ut_score;
   json["ut_total"] = ut_total;
   json["ut_turn"] = ut_turn;
+  json["warm_restore"] = warm_restore;
   json["weight_cos"] = weight_cos;
   json["weight_curve"] = weight_curve;
   json["weight_distance"] = weight_distance;
@@ -712,7 +758,10 @@ Params Params::fromJson(const QJsonObject &json) {
   if (json.contains("atp_pt_61")) { p.atp_pt_61 = json["atp_pt_61"].toDouble(); }
   if (json.contains("atp_threshold")) { p.atp_threshold = json["atp_threshold"].toDouble(); }
   if (json.contains("bad_tangent_score")) { p.bad_tangent_score = json["bad_tangent_score"].toDouble(); }
+  if (json.contains("beam_min_scenarios")) { p.beam_min_scenarios = json["beam_min_scenarios"].toDouble(); }
+  if (json.contains("beam_target_ms")) { p.beam_target_ms = json["beam_target_ms"].toDouble(); }
   if (json.contains("bjr_min_turn")) { p.bjr_min_turn = json["bjr_min_turn"].toDouble(); }
+  if (json.contains("bucket_length_ratio")) { p.bucket_length_ratio = json["bucket_length_ratio"].toDouble(); }
   if (json.contains("cat_window")) { p.cat_window = json["cat_window"].toDouble(); }
   if (json.contains("cls_distance_max_ratio")) { p.cls_distance_max_ratio = json["cls_distance_max_ratio"].toDouble(); }
   if (json.contains("cls_enable")) { p.cls_enable = json["cls_enable"].toDouble(); }
@@ -747,6 +796,9 @@ Params Params::fromJson(const QJsonObject &json) {
   if (json.contains("dst_x_max")) { p.dst_x_max = json["dst_x_max"].toDouble(); }
   if (json.contains("dst_y_add")) { p.dst_y_add = json["dst_y_add"].toDouble(); }
   if (json.contains("dst_y_max")) { p.dst_y_max = json["dst_y_max"].toDouble(); }
+  if (json.contains("early_max_depth")) { p.early_max_depth = json["early_max_depth"].toDouble(); }
+  if (json.contains("early_min_count")) { p.early_min_count = json["early_min_count"].toDouble(); }
+  if (json.contains("early_score_gap")) { p.early_score_gap = json["early_score_gap"].toDouble(); }
   if (json.contains("end_scenario_wait")) { p.end_scenario_wait = json["end_scenario_wait"].toDouble(); }
   if (json.contains("error_correct")) { p.error_correct = json["error_correct"].toDouble(); }
   if (json.contains("error_ignore_count")) { p.error_ignore_count = json["error_ignore_count"].toDouble(); }
@@ -754,6 +806,7 @@ Params Params::fromJson(const QJsonObject &json) {
   if (json.contains("fallback_min_length")) { p.fallback_min_length = json["fallback_min_length"].toDouble(); }
   if (json.contains("fallback_snapshot_queue")) { p.fallback_snapshot_queue = json["fallback_snapshot_queue"].toDouble(); }
   if (json.contains("fallback_start_count")) { p.fallback_start_count = json["fallback_start_count"].toDouble(); }
+  if (json.contains("fallback_threads")) { p.fallback_threads = json["fallback_threads"].toDouble(); }
   if (json.contains("fallback_timeout")) { p.fallback_timeout = json["fallback_timeout"].toDouble(); }
   if (json.contains("final_coef_misc")) { p.final_coef_misc = json["final_coef_misc"].toDouble(); }
   if (json.contains("final_coef_turn")) { p.final_coef_turn = json["final_coef_turn"].toDouble(); }
@@ -789,12 +842,14 @@ Params Params::fromJson(const QJsonObject &json) {
   if (json.contains("hint_v_minturn2")) { p.hint_v_minturn2 = json["hint_v_minturn2"].toDouble(); }
   if (json.contains("hint_v_range")) { p.hint_v_range = json["hint_v_range"].toDouble(); }
   if (json.contains("hints_master_switch")) { p.hints_master_switch = json["hints_master_switch"].toDouble(); }
+  if (json.contains("incr_idle_aggressive")) { p.incr_idle_aggressive = json["incr_idle_aggressive"].toDouble(); }
   if (json.contains("incr_retry")) { p.incr_retry = json["incr_retry"].toDouble(); }
   if (json.contains("incremental_index_gap")) { p.incremental_index_gap = json["incremental_index_gap"].toDouble(); }
   if (json.contains("incremental_length_lag")) { p.incremental_length_lag = json["incremental_length_lag"].toDouble(); }
   if (json.contains("inf_max")) { p.inf_max = json["inf_max"].toDouble(); }
   if (json.contains("inf_min")) { p.inf_min = json["inf_min"].toDouble(); }
   if (json.contains("inter_pt_min_dist")) { p.inter_pt_min_dist = json["inter_pt_min_dist"].toDouble(); }
+  if (json.contains("key_pass")) { p.key_pass = json["key_pass"].toDouble(); }
   if (json.contains("key_shift_ema_coef")) { p.key_shift_ema_coef = json["key_shift_ema_coef"].toDouble(); }
   if (json.contains("key_shift_enable")) { p.key_shift_enable = json["key_shift_enable"].toDouble(); }
   if (json.contains("key_shift_ratio")) { p.key_shift_ratio = json["key_shift_ratio"].toDouble(); }
@@ -813,6 +868,7 @@ Params Params::fromJson(const QJsonObject &json) {
   if (json.contains("max_segment_length")) { p.max_segment_length = json["max_segment_length"].toDouble(); }
   if (json.contains("max_star_index")) { p.max_star_index = json["max_star_index"].toDouble(); }
   if (json.contains("max_turn_index_gap")) { p.max_turn_index_gap = json["max_turn_index_gap"].toDouble(); }
+  if (json.contains("mem_stats")) { p.mem_stats = json["mem_stats"].toDouble(); }
   if (json.contains("min_turn_index_gap")) { p.min_turn_index_gap = json["min_turn_index_gap"].toDouble(); }
   if (json.contains("min_turn_index_gap_st")) { p.min_turn_index_gap_st = json["min_turn_index_gap_st"].toDouble(); }
   if (json.contains("multi_dot_threshold")) { p.multi_dot_threshold = json["multi_dot_threshold"].toDouble(); }
@@ -850,6 +906,9 @@ Params Params::fromJson(const QJsonObject &json) {
   if (json.contains("scaling_size_pow")) { p.scaling_size_pow = json["scaling_size_pow"].toDouble(); }
   if (json.contains("score_pow")) { p.score_pow = json["score_pow"].toDouble(); }
   if (json.contains("sharp_turn_penalty")) { p.sharp_turn_penalty = json["sharp_turn_penalty"].toDouble(); }
+  if (json.contains("shortlist_min_words")) { p.shortlist_min_words = json["shortlist_min_words"].toDouble(); }
+  if (json.contains("shortlist_samples")) { p.shortlist_samples = json["shortlist_samples"].toDouble(); }
+  if (json.contains("shortlist_size")) { p.shortlist_size = json["shortlist_size"].toDouble(); }
   if (json.contains("slow_down_max_turn")) { p.slow_down_max_turn = json["slow_down_max_turn"].toDouble(); }
   if (json.contains("slow_down_ratio")) { p.slow_down_ratio = json["slow_down_ratio"].toDouble(); }
   if (json.contains("small_segment_min_score")) { p.small_segment_min_score = json["small_segment_min_score"].toDouble(); }
@@ -912,6 +971,7 @@ Params Params::fromJson(const QJsonObject &json) {
   if (json.contains("ut_score")) { p.ut_score = json["ut_score"].toDouble(); }
   if (json.contains("ut_total")) { p.ut_total = json["ut_total"].toDouble(); }
   if (json.contains("ut_turn")) { p.ut_turn = json["ut_turn"].toDouble(); }
+  if (json.contains("warm_restore")) { p.warm_restore = json["warm_restore"].toDouble(); }
   if (json.contains("weight_cos")) { p.weight_cos = json["weight_cos"].toDouble(); }
   if (json.contains("weight_curve")) { p.weight_curve = json["weight_curve"].toDouble(); }
   if (json.contains("weight_distance")) { p.weight_distance = json["weight_distance"].toDouble(); }
@@ -0,0 +1,287 @@
+#include "replay.h"
+
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QRegExp>
+
+#include <string.h>
+
+#include "log.h"
+
+static void copyString(char *dest, QString src, int size) {
+  /* NUL terminated UTF-8 (truncated if too long) */
+  QByteArray utf8 = src.toUtf8();
+  int len = utf8.size();
+  if (len >= size) { len = size - 1; }
+  memset(dest, 0, size);
+  memcpy(dest, utf8.constData(), len);
+}
+
+/* --- writer --- */
+bool ReplayWriter::open(QString fileName) {
+  file.setFileName(fileName);
+  if (! file.open(QIODevice::WriteOnly | QIODevice::Truncate)) { return false; }
+
+  replay_header_t header;
+  memset(&header, 0, sizeof(header)); // written again by close()
+  file.write((const char*) &header, sizeof(header));
+
+  gestures.clear();
+  params.clear();
+  params_sets.clear();
+  overflow = false;
+  return true;
+}
+
+bool ReplayWriter::checkOffset() {
+  /* current position must fit in a 32 bits offset (stored in indexes) */
+  if (file.pos() > REPLAY_MAX_OFFSET) {
+    if (! overflow) { logdebug("Replay file too big: %s", QSTRING2PCHAR(file.fileName())); }
+    overflow = true;
+  }
+  return ! overflow;
+}
+
+int ReplayWriter::addParams(const QJsonObject &json) {
+  /* write a parameters set (only if it has not been seen before) */
+  QByteArray block;
+  quint32 count = json.size();
+  block.append((const char*) &count, sizeof(count));
+  foreach(QString name, json.keys()) {
+    replay_param_t p;
+    copyString(p.name, name, REPLAY_PARAM_SIZE);
+    p.value = json[name].toDouble();
+    block.append((const char*) &p, sizeof(p));
+  }
+
+  if (params_sets.contains(block)) { return params_sets[block]; }
+  if (! checkOffset()) { return -1; }
+
+  int index = params.size();
+  params.append(file.pos());
+  params_sets[block] = index;
+  file.write(block);
+  return index;
+}
+
+bool ReplayWriter::add(const QJsonObject &json0, QString name, QString expected) {
+  QJsonObject json = json0.contains("input")?json0["input"].toObject():json0;
+
+  QList<Key> keys;
+  foreach(QJsonValue json_key, json["keys"].toArray()) {
+    keys.append(Key::fromJson(json_key.toObject()));
+  }
+  QList<CurvePoint> curve;
+  foreach(QJsonValue json_point, json["curve"].toArray()) {
+    CurvePoint p = CurvePoint::fromJson(json_point.toObject());
+    if (! p.dummy) { curve.append(p); }
+  }
+  if (curve.isEmpty()) { return false; }
+
+  int params = addParams(json["params"].toObject());
+  if (params < 0) { return false; }
+
+  replay_gesture_t g;
+  memset(&g, 0, sizeof(g));
+  g.params = params;
+  g.id = json["id"].toDouble();
+
+  QJsonObject json_scaling = json["scaling"].toObject();
+  g.dpi = json_scaling["dpi"].toDouble();
+  g.screen_x = json_scaling["screen_x"].toDouble();
+  g.screen_y = json_scaling["screen_y"].toDouble();
+  g.pixels_x = json_scaling["pixels_x"].toDouble();
+  g.pixels_y = json_scaling["pixels_y"].toDouble();
+
+  copyString(g.name, name, REPLAY_NAME_SIZE);
+  copyString(g.expected, expected, REPLAY_WORD_SIZE);
+  copyString(g.treefile, QFileInfo(json["treefile"].toString()).fileName(), REPLAY_NAME_SIZE);
+
+  return write(g, keys, curve);
+}
+
+bool ReplayWriter::add(int params, const QList<Key> &keys, const QList<CurvePoint> &curve, int id,
+		       QString name, QString expected, QString treefile) {
+  if (curve.isEmpty() || params < 0 || params >= this -> params.size()) { return false; }
+
+  replay_gesture_t g;
+  memset(&g, 0, sizeof(g)); // no screen information
+  g.params = params;
+  g.id = id;
+  copyString(g.name, name, REPLAY_NAME_SIZE);
+  copyString(g.expected, expected, REPLAY_WORD_SIZE);
+  copyString(g.treefile, treefile, REPLAY_NAME_SIZE);
+
+  return write(g, keys, curve);
+}
+
+bool ReplayWriter::write(replay_gesture_t &g, const QList<Key> &keys, const QList<CurvePoint> &curve) {
+  g.size = sizeof(g) + keys.size() * sizeof(replay_key_t) + curve.size() * sizeof(replay_point_t);
+  g.key_count = keys.size();
+  g.point_count = curve.size();
+
+  if (! checkOffset()) { return false; }
+  gestures.append(file.pos());
+  file.write((const char*) &g, sizeof(g));
+
+  foreach(Key k, keys) {
+    replay_key_t rk;
+    rk.x = k.x;
+    rk.y = k.y;
+    rk.width = k.width;
+    rk.height = k.height;
+    copyString(rk.label, k.label, REPLAY_LABEL_SIZE);
+    file.write((const char*) &rk, sizeof(rk));
+  }
+
+  foreach(CurvePoint p, curve) {
+    replay_point_t rp;
+    rp.x = p.x;
+    rp.y = p.y;
+    rp.t = p.t;
+    rp.curve_id = p.curve_id;
+    rp.type = p.end_marker?REPLAY_POINT_END_MARKER:0;
+    rp.flags = p.flags;
+    file.write((const char*) &rp, sizeof(rp));
+  }
+  return true;
+}
+
+bool ReplayWriter::close() {
+  replay_header_t header;
+  header.magic = REPLAY_MAGIC;
+  header.version = REPLAY_VERSION;
+  header.gesture_count = gestures.size();
+  header.params_count = params.size();
+
+  bool ok = checkOffset();
+  header.params_index = file.pos();
+  foreach(quint32 offset, params) { file.write((const char*) &offset, sizeof(offset)); }
+  ok = ok && checkOffset();
+  header.gesture_index = file.pos();
+  foreach(quint32 offset, gestures) { file.write((const char*) &offset, sizeof(offset)); }
+
+  file.seek(0);
+  file.write((const char*) &header, sizeof(header));
+  ok = ok && (file.error() == QFile::NoError);
+  file.close();
+  return ok;
+}
+
+QString ReplayWriter::expectedWord(QString fileName) {
+  /* guess expected word from test case file name (same rules as tools/optim.py):
+     "[<lang>-]<word>[-<comment>].json" */
+  QString name = QFileInfo(fileName).fileName();
+  name.replace(QRegExp("\\.json$"), "");
+  name.replace(QRegExp("^[a-z][a-z]-(.)"), "\\1");
+  name.replace(QRegExp("-.*$"), "");
+  name.replace(QRegExp("[0-9]+$"), "");
+  return name;
+}
+
+/* --- reader --- */
+ReplayFile::ReplayFile() {
+  data = NULL;
+  size = 0;
+  header = NULL;
+  index = NULL;
+}
+
+ReplayFile::~ReplayFile() {
+  close();
+}
+
+void ReplayFile::close() {
+  if (data) { file.unmap(data); }
+  if (file.isOpen()) { file.close(); }
+  data = NULL;
+  header = NULL;
+  index = NULL;
+  params.clear();
+}
+
+bool ReplayFile::open(QString fileName) {
+  close();
+
+  file.setFileName(fileName);
+  if (! file.open(QIODevice::ReadOnly)) { return false; }
+  size = file.size();
+  if (size < (qint64) sizeof(replay_header_t)) { close(); return false; }
+  data = file.map(0, size);
+  if (! data) { close(); return false; }
+
+  header = (replay_header_t*) data;
+  if (header->magic != REPLAY_MAGIC || header->version != REPLAY_VERSION ||
+      (header->params_index % 4) || (header->gesture_index % 4) ||
+      header->params_index + 4 * (qint64) header->params_count > size ||
+      header->gesture_index + 4 * (qint64) header->gesture_count > size) {
+    return badFile();
+  }
+  index = (quint32*) (data + header->gesture_index);
+
+  /* parameters sets are decoded once (they are shared by many gestures) */
+  quint32 *params_index = (quint32*) (data + header->params_index);
+  for(unsigned int i = 0; i < header->params_count; i ++) {
+    if ((params_index[i] % 4) || params_index[i] + (qint64) sizeof(quint32) > size) { return badFile(); }
+    quint32 count = *((quint32*) (data + params_index[i]));
+    if (params_index[i] + (qint64) sizeof(quint32) + count * (qint64) sizeof(replay_param_t) > size) { return badFile(); }
+    replay_param_t *p = (replay_param_t*) (data + params_index[i] + sizeof(quint32));
+    QJsonObject json;
+    for(unsigned int j = 0; j < count; j ++) {
+      if (p[j].name[REPLAY_PARAM_SIZE - 1]) { return badFile(); }
+      json[QString(p[j].name)] = p[j].value;
+    }
+    params.append(Params::fromJson(json));
+  }
+
+  /* gestures are read in place without any check afterwards: validate
+     all records (bounds, strings termination & parameters set index) */
+  for(unsigned int i = 0; i < header->gesture_count; i ++) {
+    if ((index[i] % 4) || index[i] + (qint64) sizeof(replay_gesture_t) > size) { return badFile(); }
+    const replay_gesture_t *g = getGesture(i);
+    if (g->size != sizeof(replay_gesture_t) + g->key_count * (qint64) sizeof(replay_key_t) +
+	g->point_count * (qint64) sizeof(replay_point_t) ||
+	index[i] + (qint64) g->size > size ||
+	g->params >= (quint32) params.size() ||
+	g->name[REPLAY_NAME_SIZE - 1] || g->expected[REPLAY_WORD_SIZE - 1] || g->treefile[REPLAY_NAME_SIZE - 1]) {
+      return badFile();
+    }
+    const replay_key_t *keys = getKeys(i);
+    for(unsigned int j = 0; j < g->key_count; j ++) {
+      if (keys[j].label[REPLAY_LABEL_SIZE - 1]) { return badFile(); }
+    }
+  }
+
+  return true;
+}
+
+bool ReplayFile::badFile() {
+  logdebug("Bad replay file: %s", QSTRING2PCHAR(file.fileName()));
+  close();
+  return false;
+}
+
+const replay_gesture_t *ReplayFile::getGesture(int i) {
+  return (const replay_gesture_t*) (data + index[i]);
+}
+
+const replay_key_t *ReplayFile::getKeys(int i) {
+  return (const replay_key_t*) (data + index[i] + sizeof(replay_gesture_t));
+}
+
+const replay_point_t *ReplayFile::getPoints(int i) {
+  return (const replay_point_t*) (getKeys(i) + getGesture(i)->key_count);
+}
+
+const Params &ReplayFile::getParams(int i) {
+  return params.at(getGesture(i)->params);
+}
+
+bool ReplayFile::isReplayFile(QString fileName) {
+  QFile f(fileName);
+  if (! f.open(QIODevice::ReadOnly)) { return false; }
+  quint32 magic = 0;
+  bool ok = (f.read((char*) &magic, sizeof(magic)) == sizeof(magic) && magic == REPLAY_MAGIC);
+  f.close();
+  return ok;
+}
@@ -0,0 +1,139 @@
+/* binary gesture container: compact alternative to JSON test / replay files
+   for bulk replays (benchmarks, parameters optimization ...) where parsing
+   big JSON documents dominated run time.
+   File is memory mapped and gestures are read in place (fixed size records,
+   no parsing at all), parameters sets are stored once and shared between
+   gestures (most gestures use the same parameters).
+
+   File layout (host byte order, every record is 4-byte aligned):
+   - header (replay_header_t)
+   - parameters sets: count (quint32) + (name, value) pairs (replay_param_t)
+   - gestures: replay_gesture_t + keys (replay_key_t) + points (replay_point_t)
+   - parameters sets index (quint32 offsets)
+   - gestures index (quint32 offsets)
+   Offsets are 32 bits, so files are limited to 4GB (writer fails beyond)
+
+   Files are created from JSON with "cli -C" (or synthetic gestures with
+   "gen") and replayed by passing them instead of JSON input to "cli" or
+   curvebench */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <QString>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <QByteArray>
+#include <QJsonObject>
+
+#include "params.h"
+#include "scenario.h"
+
+#define REPLAY_MAGIC 0x474b424f // "OKBG"
+#define REPLAY_VERSION 1
+
+#define REPLAY_NAME_SIZE 64
+#define REPLAY_WORD_SIZE 32
+#define REPLAY_PARAM_SIZE 32
+#define REPLAY_LABEL_SIZE 8
+
+#define REPLAY_POINT_END_MARKER (1 << 0)
+
+#define REPLAY_MAX_OFFSET 0xffffffffLL
+
+typedef struct {
+  quint32 magic;
+  quint32 version;
+  quint32 gesture_count;
+  quint32 params_count;
+  quint32 params_index; // offset of parameters sets index
+  quint32 gesture_index; // offset of gestures index
+} replay_header_t;
+
+typedef struct {
+  char name[REPLAY_PARAM_SIZE];
+  float value;
+} replay_param_t;
+
+typedef struct {
+  quint32 size; // whole record size (including keys & points)
+  qint32 id;
+  quint32 params; // parameters set index
+  quint32 key_count;
+  quint32 point_count;
+  qint32 dpi;
+  float screen_x, screen_y;
+  qint32 pixels_x, pixels_y;
+  char name[REPLAY_NAME_SIZE]; // original file name (without extension)
+  char expected[REPLAY_WORD_SIZE]; // expected word (may be empty)
+  char treefile[REPLAY_NAME_SIZE]; // tree file name (without directory)
+} replay_gesture_t;
+
+typedef struct {
+  qint16 x, y, width, height;
+  char label[REPLAY_LABEL_SIZE];
+} replay_key_t;
+
+typedef struct {
+  qint32 x, y, t;
+  qint16 curve_id;
+  quint8 type; // REPLAY_POINT_*
+  quint8 flags; // CurvePoint flags (hints)
+} replay_point_t;
+
+/* converter (from JSON) */
+class ReplayWriter {
+ private:
+  QFile file;
+  QList<quint32> gestures;
+  QList<quint32> params;
+  QHash<QByteArray, int> params_sets; // parameters set contents -> index
+  bool overflow; // file is too big for 32 bits offsets
+
+  bool checkOffset();
+  bool write(replay_gesture_t &g, const QList<Key> &keys, const QList<CurvePoint> &curve);
+
+ public:
+  bool open(QString fileName);
+  int addParams(const QJsonObject &json); // -1 on error
+  bool add(const QJsonObject &json, QString name, QString expected);
+  bool add(int params, const QList<Key> &keys, const QList<CurvePoint> &curve, int id,
+	   QString name, QString expected, QString treefile); // e.g. synthetic gestures
+  bool close();
+  int getCount() { return gestures.size(); }
+
+  static QString expectedWord(QString fileName);
+};
+
+/* reader (memory mapped) */
+class ReplayFile {
+ private:
+  QFile file;
+  uchar *data;
+  qint64 size;
+  replay_header_t *header;
+  quint32 *index;
+  QVector<Params> params; // decoded parameters sets
+
+  bool badFile();
+
+ public:
+  ReplayFile();
+  ~ReplayFile();
+
+  bool open(QString fileName);
+  void close();
+  bool isOpen() { return data != NULL; }
+  int getCount() { return data?header->gesture_count:0; }
+
+  const replay_gesture_t *getGesture(int index);
+  const replay_key_t *getKeys(int index);
+  const replay_point_t *getPoints(int index);
+  const Params &getParams(int index);
+
+  static bool isReplayFile(QString fileName);
+};
+
+#endif /* REPLAY_H */
@@ -51,10 +51,16 @@ QString qlist_nextindex2str(QList<NextIndex> lst) {
 /* --- optimized curve --- */
 QuickCurve::QuickCurve() {
   count = -1;
+  alloc_count = 0;
+  pass_keys = NULL;
+  pass_serial = pass_radius = 0;
 }
 
 QuickCurve::QuickCurve(QList<CurvePoint> &curve, int curve_id, int min_length) {
   count = -1;
+  alloc_count = 0;
+  pass_keys = NULL;
+  pass_serial = pass_radius = 0;
   setCurve(curve, curve_id, min_length);
 }
 
@@ -74,6 +80,7 @@ void QuickCurve::clearCurve() {
     delete[] flags;
   }
   count = -1;
+  alloc_count = 0;
 }
 
 void QuickCurve::setCurve(QList<CurvePoint> &curve, float scaling_ratio, int curve_id, int min_length) {
@@ -85,6 +92,7 @@ void QuickCurve::setCurve(QList<CurvePoint> &curve, float scaling_ratio, int cur
 
   int cs = curve.size();
   if (! cs) { count = 0; return; }
+  alloc_count = cs;
 
   x = new int[cs];
   y = new int[cs];
@@ -135,6 +143,71 @@ void QuickCurve::setCurve(QList<CurvePoint> &curve, float scaling_ratio, int cur
   }
 }
 
+void QuickCurve::updateKeyPass(QuickKeys *keys, int radius) {
+  /* update key pass index after curve update: smoothing may still move the
+     last points, so we re-index from the first point which has changed */
+
+  if (keys != pass_keys || keys->serial != pass_serial || radius != pass_radius) {
+    // reset everything
+    pass_keys = keys;
+    pass_serial = keys->serial;
+    pass_radius = radius;
+    pass_points.clear();
+    pass_letters.clear();
+    for(int i = 0; i < 256; i ++) { pass[i].clear(); }
+    for(unsigned char l = 'a'; l <= 'z'; l ++) {
+      unsigned char *ptr = keys->getKeysForLetter(l);
+      while (ptr && *ptr) { pass_letters.append(*ptr); ptr ++; }
+    }
+  }
+
+  int n = (count > 0)?count:0;
+  int k = 0;
+  while (k < pass_points.size() && k < n && pass_points[k].x == x[k] && pass_points[k].y == y[k]) { k ++; }
+
+  if (k < pass_points.size()) {
+    pass_points.resize(k);
+    foreach(unsigned char letter, pass_letters) {
+      QVector<key_pass_t> &lst = pass[letter];
+      while (lst.size() && lst.last().start >= k) { lst.removeLast(); }
+      if (lst.size() && lst.last().end >= k) { lst.last().end = k - 1; }
+    }
+  }
+
+  int r2 = radius * radius;
+  for(int i = k; i < n; i ++) {
+    foreach(unsigned char letter, pass_letters) {
+      Point p = keys->get(letter);
+      int dx = p.x - x[i];
+      int dy = p.y - y[i];
+      if (dx * dx + dy * dy >= r2) { continue; }
+
+      QVector<key_pass_t> &lst = pass[letter];
+      if (lst.size() && lst.last().end == i - 1) {
+	lst.last().end = i;
+      } else {
+	key_pass_t kp;
+	kp.start = kp.end = i;
+	lst.append(kp);
+      }
+    }
+    pass_points.append(Point(x[i], y[i]));
+  }
+}
+
+bool QuickCurve::hasKeyPass() {
+  return pass_keys && pass_keys->serial == pass_serial;
+}
+
+int QuickCurve::nextKeyPass(unsigned char letter, int index) {
+  /* first curve index >= index where the curve gets close to the key (or -1) */
+  const QVector<key_pass_t> &lst = pass[letter];
+  for(int i = 0; i < lst.size(); i ++) {
+    if (lst[i].end >= index) { return (lst[i].start > index)?lst[i].start:index; }
+  }
+  return -1;
+}
+
 QuickCurve::~QuickCurve() {
   clearCurve();
 }
@@ -155,6 +228,14 @@ int QuickCurve::getLength(int index) { return length[index]; }
 int QuickCurve::getTimestamp(int index) { return timestamp[index]; }
 int QuickCurve::getTotalLength() { return (count > 0)?length[count - 1]:0; }
 
+int QuickCurve::getMemory() {
+  /* approximate heap usage (point arrays & key pass index) */
+  int result = alloc_count * (11 * sizeof(int) + sizeof(Point));
+  result += pass_points.capacity() * sizeof(Point) + pass_letters.capacity();
+  for(int i = 0; i < 256; i ++) { result += pass[i].capacity() * sizeof(key_pass_t); }
+  return result;
+}
+
 int QuickCurve::getFlags(int index) { return flags[index]; }
 bool QuickCurve::hasFlags(int index, int mask) { return ((flags[index] & mask) != 0); }
 
@@ -182,15 +263,19 @@ int QuickCurve::getHintOIndex(int index0, bool incremental) {
 
 /* optimized keys information */
 QuickKeys::QuickKeys() {
+  serial = 0;
 }
 
 QuickKeys::QuickKeys(QHash<QString, Key> &keys, float scaling_ratio) {
+  serial = 0;
   setKeys(keys, scaling_ratio);
 }
 
 void QuickKeys::setKeys(QHash<QString, Key> &keys, float scaling_ratio) {
   int count = 0, sum_height = 0, sum_width = 0;
 
+  serial ++;
+
   QList<QString> keylist = keys.keys();
   qSort(keylist.begin(), keylist.end());
 
@@ -480,19 +565,26 @@ Scenario::Scenario(LetterTree *tree, QuickKeys *keys, QuickCurve *curve, Params
   misc_acct = NULL;
 
   quadrant = 0;
+
+  mem = params?params->glob_mem:NULL;
+  mem_size = mem?getMemory():0;
+  if (mem) { mem->add(MEM_SCENARIO, mem_size); }
 }
 
 Scenario::Scenario(const Scenario &from) {
   // overriden copy to take care of dynamically allocated stuff
   copy_from(from);
+  if (mem) { mem->add(MEM_SCENARIO, mem_size); }
 }
 
 Scenario& Scenario::operator=(const Scenario &from) {
   // overriden copy to take care of dynamically allocated stuff
+  if (mem) { mem->remove(MEM_SCENARIO, mem_size); }
   delete[] index_history;
   delete[] letter_history;
   delete[] scores;
   copy_from(from);
+  if (mem) { mem->add(MEM_SCENARIO, mem_size); }
   return *this;
 }
 
@@ -553,10 +645,14 @@ void Scenario::copy_from(const Scenario &from) {
   }
 
   quadrant = from.quadrant;
+
+  mem = from.mem;
+  mem_size = mem?getMemory():0;
 }
 
 
 Scenario::~Scenario() {
+  if (mem) { mem->remove(MEM_SCENARIO, mem_size); }
   delete[] index_history;
   delete[] letter_history;
   delete[] scores;
@@ -812,6 +908,13 @@ float Scenario::get_next_key_match(unsigned char letter, int index, QList<NextIn
 
   bool ignore_hint_o = curve->hasFlags(start_index, FLAG_HINT_O | FLAG_HINT_o);
 
+  bool key_pass = curve->hasKeyPass();
+  if (key_pass && ! incremental && curve->nextKeyPass(letter, start_index) < 0) {
+    // the remaining curve never gets close enough to the key: the scan below could only fail
+    DBG("  [get_next_key_match] %s:%c[%d] *FAIL* key not approached by remaining curve", getNameCharPtr(), letter, start_index);
+    return -1;
+  }
+
   int step = 1;
   while(1) {
     if (index >= curve->size() - 4 && incremental) { overflow = true; return 0; }
@@ -978,7 +1081,23 @@ bool Scenario::childScenario(LetterNode &childNode, QList<Scenario> &result, sta
 }
 
 bool Scenario::childScenario(LetterNode &childNode, QList<Scenario> &result, stats_t &st, int curve_id, bool incremental, bool hasPayload, bool isLeaf) {
-  /* this method allow to override hasPayload/isLeaf flags (used with multi-scenario) */
+  /* same as above, but return copies of child scenarios (for callers that store scenarios by value) */
+  QList<ScenarioHandle> childs;
+  bool ret = childScenario(childNode, childs, st, curve_id, incremental, hasPayload, isLeaf);
+  foreach(ScenarioHandle h, childs) { result.append(*h); }
+  return ret;
+}
+
+bool Scenario::childScenario(LetterNode &childNode, QList<ScenarioHandle> &result, stats_t &st, int curve_id, bool incremental) {
+  bool hasPayload = childNode.hasPayload();
+  bool isLeaf = childNode.isLeaf();
+  return childScenario(childNode, result, st, curve_id, incremental, hasPayload, isLeaf);
+}
+
+bool Scenario::childScenario(LetterNode &childNode, QList<ScenarioHandle> &result, stats_t &st, int curve_id, bool incremental, bool hasPayload, bool isLeaf) {
+  /* this method allow to override hasPayload/isLeaf flags (used with multi-scenario)
+     child scenarios are allocated only once, and are returned as shared handles
+     (they can be shared by multiple multi-scenarios, and by the child cache) */
 
   if (curve_id > 0) { /* multi-touch not supported here */ }
   unsigned char letter = childNode.getChar();
@@ -988,29 +1107,27 @@ bool Scenario::childScenario(LetterNode &childNode, QList<Scenario> &result, sta
     cache = false;
     logdebug("ERROR: Scenario::childScenario requires an empty list as input when cache is activated!");
   }
-  if (cache) {
-    child_cache_t *cc = cacheChilds.data();
-    if (cc && cc->contains(letter)) {
+  int slot = CHILD_CACHE_SLOT(letter);
+  ChildCache *cc = (cache && slot >= 0)?cacheChilds.data():NULL;
+
+  bool partial = incremental && ! curve->finished; // curve is not complete yet
+
+  if (cc) {
+    if (cc->filled & (1U << slot)) {
       // positive caching
-      result.append((*cc)[letter]);
+      result.append(cc->childs[slot]);
       st.st_cache_hit ++;
       return true;
     }
-    /* no significant impact with current settings
-    if (cacheMinLength.contains(letter)) {
-      // negative caching
-      int min_len = cacheMinLength[letter];
-      if (curve->getTotalLength() <= min_len) {
-	st.st_cache_hit ++;
-	return false;
-      }
+    if (partial && cc->wait_length[slot] && curve->getTotalLength() <= cc->wait_length[slot]) {
+      // negative caching: curve is not longer than last time, so the answer is still "try again later"
+      st.st_cache_hit ++;
+      st.st_cache_neg ++;
+      return false;
     }
-    */
   }
 
   st.st_cache_miss ++;
-
-  bool partial = incremental && ! curve->finished; // curve is not complete yet
   bool isDot = curve->isDot;
 
   // step 1: find non-ending child scenarios
@@ -1018,11 +1135,7 @@ bool Scenario::childScenario(LetterNode &childNode, QList<Scenario> &result, sta
     int len_before = result.size();
     if (! childScenarioInternal(childNode, result, st.st_fork, partial /* incremental */, false)) {
       // try again later
-      /*
-      if (cache) {
-	cacheMinLength[letter] = curve->getTotalLength();
-      }
-      */
+      if (cc) { cc->wait_length[slot] = curve->getTotalLength(); }
       return false;
     }
     int len_after = result.size();
@@ -1036,13 +1149,14 @@ bool Scenario::childScenario(LetterNode &childNode, QList<Scenario> &result, sta
 
 	int curve_index = 0;
 	for(int i = len_before; i < len_after; i ++) {
-	  curve_index = max(curve_index, result[i].getCurveIndex());
+	  curve_index = max(curve_index, result[i]->getCurveIndex());
 	}
 	for(int i = len_before; i < len_after; i ++) {
 	  result.removeLast();
 	}
 
 	if (curve->getTotalLength() < curve->getLength(curve_index) + params->end_scenario_wait) {
+	  if (cc) { cc->wait_length[slot] = curve->getTotalLength(); }
 	  return false; // we must wait for curve to be longer to test end scenario
 	}
 
@@ -1061,15 +1175,16 @@ bool Scenario::childScenario(LetterNode &childNode, QList<Scenario> &result, sta
   }
 
   // update cache
-  if (cache) {
-    child_cache_t *cc = cacheChilds.data();
-    (*cc)[letter] = result;
+  if (cc) {
+    cc->childs[slot] = result;
+    foreach(ScenarioHandle h, result) { st.st_cache_mem += h->getMemory(); }
+    cc->filled |= (1U << slot);
   }
 
   return true;
 }
 
-bool Scenario::childScenarioInternal(LetterNode &childNode, QList<Scenario> &result, int &st_fork, bool incremental, bool endScenario) {
+bool Scenario::childScenarioInternal(LetterNode &childNode, QList<ScenarioHandle> &result, int &st_fork, bool incremental, bool endScenario) {
   unsigned char letter = childNode.getChar();
   unsigned char *ptr = keys->getKeysForLetter(letter);
 
@@ -1088,7 +1203,7 @@ bool Scenario::childScenarioInternal(LetterNode &childNode, QList<Scenario> &res
   return true;
 }
 
-bool Scenario::childScenarioInternalWithLetter(unsigned char letter, LetterNode &childNode, QList<Scenario> &result,
+bool Scenario::childScenarioInternalWithLetter(unsigned char letter, LetterNode &childNode, QList<ScenarioHandle> &result,
 					       int &st_fork, bool incremental, bool endScenario) {
   unsigned char prev_letter = (count > 0)?letter_history[count - 1]:0;
   int index = this -> index;
@@ -1148,7 +1263,6 @@ bool Scenario::childScenarioInternalWithLetter(unsigned char letter, LetterNode
 
   bool first = true;
   int continue_count = 0;
-  Scenario *first_scenario = NULL;
 
   foreach(NextIndex nit, new_index_list) {
     int new_index = nit.index;
@@ -1188,8 +1302,9 @@ bool Scenario::childScenarioInternalWithLetter(unsigned char letter, LetterNode
 
     float new_score = -1;
     if (ok) {
-      // create a new scenario for this child node
-      Scenario new_scenario(*this); // use our copy constructor
+      // create a new scenario for this child node (directly in its final location)
+      ScenarioHandle new_scenario_p(new Scenario(*this)); // use our copy constructor
+      Scenario &new_scenario = *new_scenario_p;
       new_scenario.node = childNode;
       new_scenario.index = new_index;
       new_scenario.scores[count] = score;
@@ -1201,7 +1316,7 @@ bool Scenario::childScenarioInternalWithLetter(unsigned char letter, LetterNode
       new_scenario.error_count = error_count + error_ignore?1:0;
 
       if (cache) {
-	new_scenario.cacheChilds = QSharedPointer<child_cache_t>(new child_cache_t); // do not inherit parent cache :-)
+	new_scenario.cacheChilds = QSharedPointer<ChildCache>(new ChildCache()); // do not inherit parent cache :-)
       }
 
       // number of keys actually crossed
@@ -1226,21 +1341,14 @@ bool Scenario::childScenarioInternalWithLetter(unsigned char letter, LetterNode
 
       continue_count ++;
       if (continue_count >= 2) {
-	if (first_scenario) {
-	  first_scenario->last_fork = count + 1;
-	  first_scenario = NULL;
-	}
 	new_scenario.last_fork = count + 1;
-
-      } else {
-	first_scenario = &new_scenario;
       }
 
       // temporary score is used only for simple filtering
       new_score = new_scenario.temp_score = 1.0 / (1.0 + new_scenario.dist / 30) -
 	params->coef_error_tmp * error_count * (1 + params->final_coef_turn);
 
-      result.append(new_scenario);
+      result.append(new_scenario_p);
     }
 
     DBG("debug [%s:%c] %s%s %d:%d %s [d=%.2f cr=%.2f cs=%.2f l=%.2f t=%.2f] --- Score: %.3f -> %.3f",
@@ -1314,6 +1422,13 @@ float Scenario::getCount() const {
   return count;
 }
 
+int Scenario::getMemory() const {
+  /* approximate memory used by a scenario (including dynamically allocated history) */
+  int mem = sizeof(Scenario) + (count + 1) * (sizeof(unsigned char) + sizeof(score_t)) + count + 2;
+  if (misc_acct) { mem += sizeof(QList<MiscAcct>) + misc_acct->size() * sizeof(MiscAcct); }
+  return mem;
+}
+
 QString Scenario::getName() const {
   QString ret;
   ret.append((char*) getNameCharPtr());
@@ -3389,11 +3504,12 @@ bool Scenario::nextLength(unsigned char next_letter, int curve_id, int &min_leng
 void Scenario::setCache(bool value) {
   cache = value;
   if (cache) {
-    cacheChilds = QSharedPointer<child_cache_t>(new child_cache_t);
+    cacheChilds = QSharedPointer<ChildCache>(new ChildCache());
   }
 }
 
-void Scenario::descent(LetterNode currentNode, QList<QPair<LetterNode, QString> > &result, unsigned char *pname) {
+void Scenario::descent(LetterNode currentNode, QList<QPair<LetterNode, QString> > &result, unsigned char *pname, const QSet<int> *filter) {
+  if (filter && ! filter -> contains(currentNode.getIndex())) { return; } // no compatible word in this subtree
   if (currentNode.hasPayload()) {
     QString name;
     name.append((char*) pname);
@@ -3406,14 +3522,14 @@ void Scenario::descent(LetterNode currentNode, QList<QPair<LetterNode, QString>
       memcpy(childName, pname, len);
       childName[len] = child.getChar();
       childName[len + 1] = '\0';
-      descent(child, result, childName);
+      descent(child, result, childName, filter);
       delete childName;
     }
   }
 }
 
 
-void Scenario::deepDive(QList<Scenario> &result, float min_score) {
+void Scenario::deepDive(QList<Scenario> &result, float min_score, const QSet<int> *filter) {
   /*
     Generate all possible child scenarios as fast as possible
     this is used for bad strokes that would lead to no result.
@@ -3425,7 +3541,7 @@ void Scenario::deepDive(QList<Scenario> &result, float min_score) {
   */
   QList<QPair<LetterNode, QString> > nodes;
 
-  descent(this->node, nodes, letter_history);
+  descent(this->node, nodes, letter_history, filter);
 
   score_t default_score = {NO_SCORE, NO_SCORE, NO_SCORE, NO_SCORE, NO_SCORE, NO_SCORE};
 
@@ -3479,6 +3595,7 @@ void Scenario::deepDive(QList<Scenario> &result, float min_score) {
 
     new_scenario.count = new_count;
     new_scenario.finished = true;
+    new_scenario.memUpdate();
 
     new_scenario.fallback_count = count;
 
@@ -3500,6 +3617,15 @@ void Scenario::log_misc(QString name, QString coef_name, float coef_value, float
   }
 
   misc_acct -> append(MiscAcct(coef_name, coef_value, value));
+  memUpdate();
+}
+
+void Scenario::memUpdate() {
+  /* account for a change in dynamically allocated data */
+  if (! mem) { return; }
+  int size = getMemory();
+  mem->add(-1, size - mem_size);
+  mem_size = size;
 }
 
 
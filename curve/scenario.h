@@ -14,7 +14,10 @@
 #include <QJsonValue>
 #include <QDebug>
 #include <QTime>
+#include <QElapsedTimer>
 #include <QSharedPointer>
+#include <QVector>
+#include <QAtomicInt>
 
 #include "tree.h"
 #include "log.h"
@@ -88,10 +91,27 @@ class Key {
 };
 
 /* quick curve implementation */
+class QuickKeys;
+
+typedef struct {
+  int start;
+  int end;
+} key_pass_t;
+
 class QuickCurve {
   // accessing QList<CurvePoint> continually proved to be too slow according to profiler
   // so this is a naive C-like implementation
  private:
+  /* key pass index: for each key, intervals of curve indexes where the curve
+     is close enough to the key for a positive distance score.
+     It is updated incrementally (only new or moved points are indexed) */
+  QuickKeys *pass_keys;
+  int pass_serial;
+  int pass_radius;
+  QVector<Point> pass_points; // already indexed points
+  QVector<unsigned char> pass_letters;
+  QVector<key_pass_t> pass[256];
+
   int *x;
   int *y;
   int *turn;
@@ -106,6 +126,7 @@ class QuickCurve {
   int *flags;
   Point *points;
   int count;
+  int alloc_count; // allocated size of above arrays
 
  public:
   QuickCurve(QList<CurvePoint> &curve, int curve_id = 0, int min_length = 1);
@@ -139,8 +160,14 @@ class QuickCurve {
   float straight;
 
   int getCount() { return count; }
+  int getMemory();
   int getTotalLength();
   int getLength(int index);
+
+  void updateKeyPass(QuickKeys *keys, int radius);
+  void clearKeyPass() { pass_keys = NULL; }
+  bool hasKeyPass();
+  int nextKeyPass(unsigned char letter, int index);
 };
 
 /* quick key information implementation */
@@ -169,6 +196,8 @@ class QuickKeys {
 
   // statistics
   int average_width, average_height;
+
+  int serial; // incremented each time keys are updated
 };
 
 /* tree traversal evaluation */
@@ -212,10 +241,69 @@ class DelayedScenario;
 typedef struct {
   int st_time, st_count, st_fork, st_skim;
   int st_speed, st_special, st_retry;
-  int st_cache_hit, st_cache_miss;
+  int st_cache_hit, st_cache_miss, st_cache_neg, st_cache_mem;
   int st_cputime;
+  int st_spec_ok, st_spec_abort;
+  int st_deadline, st_truncated;
+  int st_early, st_early_ok; // provisional results sent, last one confirmed by final result
+  int st_beam_width, st_beam_min, st_beam_up, st_beam_down;
+  int st_shortlist, st_bucket, st_bucket_cut;
+  int st_t_preprocess, st_t_expand, st_t_filter, st_t_fallback, st_t_postprocess, st_t_sort; // phase times (microseconds)
+  int st_mem_live, st_mem_peak, st_mem_curve, st_mem_snapshot; // memory (bytes)
+  int st_mem_scenario, st_mem_multi, st_mem_delayed; // peak object counts
+  int st_cold, st_load_restored; // first gesture after dictionary (re)load, from warm snapshot
+  int st_t_load_tree, st_t_load_user, st_t_load_keys; // first gesture penalty (microseconds)
 } stats_t;
 
+/* phase timer: add elapsed time (monotonic clock) to a stats_t counter
+   when going out of scope */
+class PhaseTimer {
+ private:
+  QElapsedTimer timer;
+  int *counter;
+ public:
+  PhaseTimer(int &counter) : counter(&counter) { timer.start(); }
+  ~PhaseTimer() { *counter += (int) (timer.nsecsElapsed() / 1000); }
+};
+
+/* memory accounting for a matching session: live / peak bytes and object
+   counts. Scenarios of all kinds register themselves (and their dynamically
+   allocated history) when they are created, copied or destroyed.
+   Counters are atomic because fallback deep dives run in worker threads */
+#define MEM_SCENARIO 0
+#define MEM_MULTI 1
+#define MEM_DELAYED 2
+#define MEM_TYPES 3
+
+class MemStats {
+ private:
+  QAtomicInt bytes, peak_bytes;
+  QAtomicInt objects[MEM_TYPES], peak_objects[MEM_TYPES];
+
+  static void updatePeak(QAtomicInt &peak, int value) {
+    int old = peak.load();
+    while (value > old && ! peak.testAndSetRelaxed(old, value)) { old = peak.load(); }
+  }
+
+ public:
+  /* counters only (no ordering with other data): relaxed atomic operations */
+  void add(int type, int size) {
+    if (type >= 0) { updatePeak(peak_objects[type], objects[type].fetchAndAddRelaxed(1) + 1); }
+    updatePeak(peak_bytes, bytes.fetchAndAddRelaxed(size) + size);
+  }
+  void remove(int type, int size) {
+    if (type >= 0) { objects[type].fetchAndAddRelaxed(-1); }
+    bytes.fetchAndAddRelaxed(- size);
+  }
+  void resetPeak() {
+    peak_bytes.store(bytes.load());
+    for(int i = 0; i < MEM_TYPES; i ++) { peak_objects[i].store(objects[i].load()); }
+  }
+  int getBytes() { return bytes.load(); }
+  int getPeakBytes() { return peak_bytes.load(); }
+  int getPeakObjects(int type) { return peak_objects[type].load(); }
+};
+
 typedef struct {
   int direction; // was char, but char to int conversion seems to handle these as unsigned chars (didn't investigate)
   int corrected_direction;
@@ -256,7 +344,24 @@ class MiscAcct {
 };
 
 class Scenario;
-typedef QHash<unsigned char, QList<Scenario> > child_cache_t;
+typedef QSharedPointer<Scenario> ScenarioHandle;
+
+/* child scenarios cache (used when the same sub-scenario is reused in
+   multiple multi-scenarios): one slot per child letter (word tree letters
+   are 'a'-'z', i.e. 96 + n), slots hold shared handles to child scenarios.
+   Negative caching: we also remember the curve length for which evaluation
+   has been postponed, so we don't retry until curve is longer */
+#define CHILD_CACHE_SLOTS 32
+#define CHILD_CACHE_SLOT(letter) (((letter) > 96 && (letter) < 96 + CHILD_CACHE_SLOTS)?((letter) - 96):-1)
+
+class ChildCache {
+ public:
+  quint32 filled; // slots with a (positive) cached result
+  int wait_length[CHILD_CACHE_SLOTS]; // negative cache: curve length when evaluation has been postponed (0 = none)
+  QList<ScenarioHandle> childs[CHILD_CACHE_SLOTS];
+
+  ChildCache() : filled(0) { memset(wait_length, 0, sizeof(wait_length)); };
+};
 
 #ifdef INCREMENTAL
 class MultiScenario;
@@ -313,13 +418,17 @@ class Scenario {
 
   // cache
   bool cache;
-  QSharedPointer<child_cache_t> cacheChilds;
-  // no significant impact: @todo try this with aggressive mode: QHash<unsigned char, int> cacheMinLength;
+  QSharedPointer<ChildCache> cacheChilds;
 
   QList<MiscAcct> *misc_acct;
 
   char quadrant;
 
+  // memory accounting
+  MemStats *mem;
+  int mem_size;
+  void memUpdate();
+
  private:
   float calc_distance_score(unsigned char letter, int index, int count, float *return_distance = NULL);
   float calc_cos_score(unsigned char prev_letter, unsigned char letter, int index, int new_index);
@@ -336,14 +445,14 @@ class Scenario {
   float get_next_key_match(unsigned char letter, int index, QList<NextIndex> &new_index, bool incremental, bool &overflow);
   float evalScore();
   void copy_from(const Scenario &from);
-  bool childScenarioInternal(LetterNode &child, QList<Scenario> &result, int &st_fork, bool incremental, bool endScenario);
-  bool childScenarioInternalWithLetter(unsigned char letter, LetterNode &child, QList<Scenario> &result,
+  bool childScenarioInternal(LetterNode &child, QList<ScenarioHandle> &result, int &st_fork, bool incremental, bool endScenario);
+  bool childScenarioInternalWithLetter(unsigned char letter, LetterNode &child, QList<ScenarioHandle> &result,
 				       int &st_fork, bool incremental, bool endScenario);
   int getLocalTurn(int index);
   void turn_transfer(int turn_count, turn_t *turn_detail);
   void calc_straight_score_all(turn_t *turn_detail, int turn_count, float straight_score);
   void calc_loop_score_all(turn_t *turn_detail, int turn_count);
-  void descent(LetterNode currentNode, QList<QPair<LetterNode, QString> > &result, unsigned char *pname);
+  void descent(LetterNode currentNode, QList<QPair<LetterNode, QString> > &result, unsigned char *pname, const QSet<int> *filter = NULL);
   void calc_flat2_score_all();
   void calc_flat2_score_part(int i1, int i2);
   int calc_flat2_get_height(int i1, int i2);
@@ -359,6 +468,8 @@ class Scenario {
   QList<LetterNode> getNextKeys();
   bool childScenario(LetterNode &child, QList<Scenario> &result, stats_t &st, int curve_id = -1, bool incremental = false);
   bool childScenario(LetterNode &child, QList<Scenario> &result, stats_t &st, int curve_id, bool incremental, bool hasPayload, bool isLeaf);
+  bool childScenario(LetterNode &child, QList<ScenarioHandle> &result, stats_t &st, int curve_id = -1, bool incremental = false);
+  bool childScenario(LetterNode &child, QList<ScenarioHandle> &result, stats_t &st, int curve_id, bool incremental, bool hasPayload, bool isLeaf);
   bool operator<(const Scenario &other) const;
   bool isFinished() { return finished; };
   QString getName() const;
@@ -393,6 +504,7 @@ class Scenario {
   bool nextLength(unsigned char next_letter, int curve_id, int &min, int &max);
   float getScoreV1() { return score_v1; };
   void setCache(bool value);
+  int getMemory() const;
 
   void newDistance();
   float getNewDistance() { return new_dist; };
@@ -401,7 +513,7 @@ class Scenario {
 
   void setCurveCount(int) {}; // for compatibility only
 
-  void deepDive(QList<Scenario> &result, float min_score = 0.);
+  void deepDive(QList<Scenario> &result, float min_score = 0., const QSet<int> *filter = NULL);
 
   QList<QPair<unsigned char, Point> > get_key_error(void);
 
@@ -0,0 +1,274 @@
+#include "shortlist.h"
+
+#include <QStringList>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "log.h"
+
+ShortlistIndex::ShortlistIndex(LetterTree *tree, QString tree_file, QHash<QString, Key> &keys, int samples) {
+  this -> tree_file = tree_file;
+  this -> layout = layoutSignature(keys);
+  this -> samples = SHORTLIST_SAMPLES(samples);
+  count = 0;
+
+  // only keys without diacritics (ideal path goes through the plain letter key)
+  foreach(Key key, keys) {
+    if (key.letter && key.label.at(0).cell() == key.letter) {
+      key_pos[key.letter] = Point(key.x, key.y);
+    }
+  }
+
+  if (! tree) { return; }
+
+  QByteArray prefix;
+  addWords(tree -> getRoot(), prefix);
+
+  for(QHash<int, QVector<QPair<int, int> > >::iterator it = buckets.begin(); it != buckets.end(); it ++) {
+    std::sort(it.value().begin(), it.value().end());
+  }
+
+  logdebug("Dictionary index: %d words (%d without keys), %d samples, %d buckets, memory: %dkB",
+	   count, unmapped.size(), samples, buckets.size(), getMemory() / 1024);
+}
+
+QString ShortlistIndex::layoutSignature(QHash<QString, Key> &keys) {
+  QStringList lst;
+  foreach(Key key, keys) {
+    lst << QString("%1:%2:%3").arg(key.label).arg(key.x).arg(key.y);
+  }
+  lst.sort();
+  return lst.join(",");
+}
+
+bool ShortlistIndex::isValid(QString tree_file, QString layout, int samples) {
+  return tree_file == this -> tree_file && layout == this -> layout && SHORTLIST_SAMPLES(samples) == this -> samples;
+}
+
+int ShortlistIndex::getMemory() {
+  return sizeof(ShortlistIndex) + paths.size() * sizeof(qint16) + word_offset.size() * sizeof(int) + letters.size()
+    + count * sizeof(QPair<int, int>) + unmapped.size() * sizeof(int);
+}
+
+static void curvePoints(QList<CurvePoint> &curve, QVector<Point> &result) {
+  // only first curve is used (multi-touch gestures are not supported)
+  foreach(CurvePoint p, curve) {
+    if (p.curve_id != 0 || p.end_marker) { continue; }
+    result.append(Point(p.x, p.y));
+  }
+}
+
+static float distance(const Point &p1, const Point &p2) {
+  return sqrt(pow(p1.x - p2.x, 2) + pow(p1.y - p2.y, 2));
+}
+
+void ShortlistIndex::addWords(LetterNode node, QByteArray &prefix) {
+  if (node.hasPayload() && prefix.size()) {
+    int length, bucket;
+    if (addPath(prefix.constData(), length, bucket)) {
+      buckets[bucket].append(QPair<int, int>(length, count));
+    } else {
+      unmapped.append(count);
+    }
+    word_offset.append(letters.size());
+    letters.append(prefix);
+    letters.append('\0');
+    count ++;
+  }
+
+  if (node.isLeaf()) { return; }
+  foreach(LetterNode child, node.getChilds()) {
+    prefix.append((char) child.getChar());
+    addWords(child, prefix);
+    prefix.chop(1);
+  }
+}
+
+bool ShortlistIndex::addPath(const char *word, int &length, int &bucket) {
+  /* ideal path through letter keys (letters without a plain key are skipped)
+     bucket uses first and last letters which have a key
+     returns false if no letter has a key (path is then empty) */
+  QVector<Point> points;
+  length = 0;
+  unsigned char first = 0, last = 0;
+  for(const char *p = word; *p; p ++) {
+    if (! key_pos.contains((unsigned char) *p)) { continue; } // no key for this letter
+    if (! first) { first = *p; }
+    last = *p;
+    Point pt = key_pos[(unsigned char) *p];
+    if (points.size() && points.last().x == pt.x && points.last().y == pt.y) { continue; } // double letters
+    if (points.size()) { length += distance(points.last(), pt); }
+    points.append(pt);
+  }
+
+  int offset = paths.size();
+  paths.resize(offset + 2 * samples);
+  resample(points, samples, paths.data() + offset);
+  bucket = (first << 8) | last;
+  return points.size() > 0;
+}
+
+void ShortlistIndex::resample(const QVector<Point> &points, int samples, qint16 *result) {
+  /* sample a polyline at evenly spaced points (along its length) */
+  int n = points.size();
+  if (! n) { memset(result, 0, 2 * samples * sizeof(qint16)); return; }
+
+  float total = 0;
+  for(int i = 1; i < n; i ++) { total += distance(points[i], points[i - 1]); }
+
+  int j = 0;
+  float pos = 0; // curve length at points[j]
+  for(int k = 0; k < samples; k ++) {
+    float target = total * k / (samples - 1);
+    while (j < n - 2) {
+      float seg = distance(points[j + 1], points[j]);
+      if (pos + seg >= target) { break; }
+      pos += seg;
+      j ++;
+    }
+
+    if (n == 1) {
+      result[2 * k] = points[0].x;
+      result[2 * k + 1] = points[0].y;
+    } else {
+      float seg = distance(points[j + 1], points[j]);
+      float r = (seg > 0)?(target - pos) / seg:0;
+      if (r < 0) { r = 0; }
+      if (r > 1) { r = 1; }
+      result[2 * k] = points[j].x + r * (points[j + 1].x - points[j].x);
+      result[2 * k + 1] = points[j].y + r * (points[j + 1].y - points[j].y);
+    }
+  }
+}
+
+QVector<int> ShortlistIndex::query(QList<CurvePoint> &curve, int size, const QVector<int> *subset) {
+  /* return the "size" nearest words (as indexes), optionally only among a
+     subset of the dictionary (e.g. from bucketWords)
+     inner loop is written on plain arrays so the compiler can vectorize it, and
+     we give up early (block by block) on words which are already worse than
+     the current shortlist */
+  QVector<int> result;
+  if (! count || size <= 0) { return result; }
+
+  QVector<Point> points;
+  curvePoints(curve, points);
+  if (! points.size()) { return result; }
+
+  qint16 g16[2 * SHORTLIST_MAX_SAMPLES];
+  resample(points, samples, g16);
+  float g[2 * SHORTLIST_MAX_SAMPLES];
+  for(int i = 0; i < 2 * samples; i ++) { g[i] = g16[i]; }
+
+  std::vector<QPair<float, int> > heap; // max-heap: worst word of the shortlist first
+  heap.reserve(size + 1);
+
+  const int block = 8; // values (i.e. 4 points) between early exit checks
+  const int len = 2 * samples;
+  int total = subset?subset -> size():count;
+
+  for(int n = 0; n < total; n ++) {
+    int w = subset?subset -> at(n):n;
+    const qint16 *path = paths.constData() + w * len;
+    float limit = ((int) heap.size() >= size)?heap.front().first:-1;
+    float dist = 0;
+    for(int i = 0; i < len; i += block) {
+      int end = (i + block < len)?i + block:len;
+      float d = 0;
+      for(int k = i; k < end; k ++) {
+	float v = g[k] - path[k];
+	d += v * v;
+      }
+      dist += d;
+      if (limit >= 0 && dist >= limit) { break; }
+    }
+
+    if (limit >= 0 && dist >= limit) { continue; }
+    heap.push_back(QPair<float, int>(dist, w));
+    std::push_heap(heap.begin(), heap.end());
+    if ((int) heap.size() > size) {
+      std::pop_heap(heap.begin(), heap.end());
+      heap.pop_back();
+    }
+  }
+
+  std::sort_heap(heap.begin(), heap.end());
+  for(unsigned int i = 0; i < heap.size(); i ++) { result.append(heap[i].second); }
+  return result;
+}
+
+QList<unsigned char> ShortlistIndex::nearKeys(Point pt, float radius) {
+  /* letters of keys near a point (nearest key is always included) */
+  QList<unsigned char> result;
+  unsigned char nearest = 0;
+  float nearest_dist = 0;
+  QHashIterator<unsigned char, Point> it(key_pos);
+  while (it.hasNext()) {
+    it.next();
+    float d = distance(pt, it.value());
+    if (d <= radius) { result.append(it.key()); }
+    if (! nearest || d < nearest_dist) { nearest = it.key(); nearest_dist = d; }
+  }
+  if (nearest && ! result.contains(nearest)) { result.append(nearest); }
+  return result;
+}
+
+void ShortlistIndex::bucketWords(QList<CurvePoint> &curve, float start_radius, float end_radius, float length_ratio, QVector<int> &result) {
+  /* words starting and ending near the gesture start and end points, and with
+     an ideal path length compatible with the gesture length
+     (user may start or end anywhere on the keys, and ideal path is just an
+     approximation of the gesture, hence the large tolerance) */
+  QVector<Point> points;
+  curvePoints(curve, points);
+  if (! points.size()) { return; }
+
+  float length = 0;
+  for(int i = 1; i < points.size(); i ++) { length += distance(points[i], points[i - 1]); }
+
+  float slack = start_radius + end_radius;
+  int min_length = length / (1 + length_ratio) - slack;
+  int max_length = length * (1 + length_ratio) + slack;
+
+  QList<unsigned char> first = nearKeys(points.first(), start_radius);
+  QList<unsigned char> last = nearKeys(points.last(), end_radius);
+
+  foreach(unsigned char f, first) {
+    foreach(unsigned char l, last) {
+      int bucket = (f << 8) | l;
+      QHash<int, QVector<QPair<int, int> > >::const_iterator b = buckets.constFind(bucket); // index is shared between threads
+      if (b == buckets.constEnd()) { continue; }
+      const QVector<QPair<int, int> > &lst = b.value();
+      QVector<QPair<int, int> >::const_iterator it = std::lower_bound(lst.begin(), lst.end(), QPair<int, int>(min_length, -1));
+      while (it != lst.end() && it -> first <= max_length) {
+	result.append(it -> second);
+	it ++;
+      }
+    }
+  }
+}
+
+void ShortlistIndex::markNodes(LetterTree *tree, const QVector<int> &words, QSet<int> &nodes) {
+  /* find tree nodes leading to selected words (they can be searched in any
+     version of the tree, e.g. if it has been updated by learning)
+     words which could not be indexed are always included */
+  nodes.insert(tree -> getRoot().getIndex());
+  foreach(int w, words) { markLetters(tree, getLetters(w), nodes); }
+  foreach(int w, unmapped) { markLetters(tree, getLetters(w), nodes); }
+}
+
+void ShortlistIndex::markLetters(LetterTree *tree, const char *letters, QSet<int> &nodes) {
+  LetterNode node = tree -> getRoot();
+  for(const char *p = letters; *p; p ++) {
+    bool found = false;
+    foreach(LetterNode child, node.getChilds()) {
+      if (child.getChar() == (unsigned char) *p) {
+	node = child;
+	found = true;
+	break;
+      }
+    }
+    if (! found) { break; }
+    nodes.insert(node.getIndex());
+  }
+}
@@ -0,0 +1,72 @@
+/* dictionary index: this is a pre-filter for the tree search with very
+   large dictionaries, only usable once the gesture is complete.
+
+   Template shortlist: for each word in the tree, we store the ideal path
+   through key centres, resampled at a fixed number of points (evenly spaced
+   along the path). At match time, the gesture is resampled the same way and
+   we keep the nearest words (sum of squared point distances).
+
+   Buckets: words are also grouped by (first key, last key) and sorted by
+   ideal path length, so words compatible with the gesture start point, end
+   point and length can be found without scanning the whole dictionary.
+
+   Normal scenario scoring is then only run on the tree nodes leading to
+   these words.
+   Letters without a plain key (e.g. diacritics) are skipped in ideal paths,
+   and words without any such letter are never filtered out.
+   The index is built for a tree file: words learned afterwards are not
+   included, so callers must let them through (cf. MatchEngine::getUserNodes) */
+
+#ifndef SHORTLIST_H
+#define SHORTLIST_H
+
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QSet>
+#include <QVector>
+#include <QByteArray>
+
+#include "tree.h"
+#include "scenario.h"
+
+#define SHORTLIST_MAX_SAMPLES 64
+#define SHORTLIST_SAMPLES(n) (((n) < 2)?2:(((n) > SHORTLIST_MAX_SAMPLES)?SHORTLIST_MAX_SAMPLES:(n)))
+
+class ShortlistIndex {
+ private:
+  QString tree_file;
+  QString layout;
+  int samples;
+  int count;
+
+  QVector<qint16> paths; // count * samples * 2 (x, y)
+  QVector<int> word_offset; // offset in letters buffer
+  QByteArray letters; // '\0' separated words (tree letters)
+  QHash<int, QVector<QPair<int, int> > > buckets; // (first << 8 | last) -> (ideal length, word index) sorted by length
+  QVector<int> unmapped; // words without any letter on a plain key (always selected)
+
+  QHash<unsigned char, Point> key_pos;
+
+  void addWords(LetterNode node, QByteArray &prefix);
+  bool addPath(const char *word, int &length, int &bucket);
+  QList<unsigned char> nearKeys(Point pt, float radius);
+
+ public:
+  ShortlistIndex(LetterTree *tree, QString tree_file, QHash<QString, Key> &keys, int samples);
+
+  static QString layoutSignature(QHash<QString, Key> &keys);
+  static void resample(const QVector<Point> &points, int samples, qint16 *result);
+
+  bool isValid(QString tree_file, QString layout, int samples);
+  int getCount() { return count; }
+  int getMemory();
+  const char* getLetters(int index) { return letters.constData() + word_offset[index]; }
+
+  QVector<int> query(QList<CurvePoint> &curve, int size, const QVector<int> *subset = NULL);
+  void bucketWords(QList<CurvePoint> &curve, float start_radius, float end_radius, float length_ratio, QVector<int> &result);
+  void markNodes(LetterTree *tree, const QVector<int> &words, QSet<int> &nodes);
+  static void markLetters(LetterTree *tree, const char *letters, QSet<int> &nodes);
+};
+
+#endif /* SHORTLIST_H */
@@ -7,6 +7,7 @@
 #include <stdio.h>
 
 #include "log.h"
+#include "trace.h"
 
 static float cpu_user(struct rusage &start, struct rusage &stop) {
   return (float) (stop.ru_utime.tv_sec - start.ru_utime.tv_sec) +
@@ -25,59 +26,65 @@ ThreadCallBack::~ThreadCallBack() {}
 CurveThread::CurveThread(QObject *parent) :
   QThread(parent)
 {
-  waiting = false;
   idle = false;
   callback = NULL;
   matcher = NULL;
+  dropped = 0;
+  first = true;
 }
 
-void CurveThread::learn(QString word, int addValue) {
-  {
-    QMutexLocker locker(&learnMutex);
-    learnQueue.append(QPair<QString, int>(word, addValue));
+void CurveThread::post(const ThreadEvent &event) {
+  if (! isRunning()) { start(); }
+  interrupt.storeRelease(1);
+  while (! queue.push(event)) {
+    // queue is full: this only happens if matcher thread is stuck, so a few lost points do not matter
+    if (event.type == EVT_POINT) { dropped.fetchAndAddRelaxed(1); return; }
+    // ... but control events must not be lost
+    QThread::yieldCurrentThread();
   }
-  addPoint(Point(CMD_LEARN, 0));
+}
+
+void CurveThread::learn(QString word, int addValue) {
+  post(ThreadEvent(EVT_LEARN, addValue, word));
 }
 
 void CurveThread::clearCurve() {
-  addPoint(Point(CMD_CLEAR, 0));
+  trace_thread_name("client");
+  trace_instant("clearCurve");
+  post(ThreadEvent(EVT_CLEAR));
   first = true;
 }
 
 void CurveThread::addPoint(Point point, int curve_id, int timestamp) {
-  if (! isRunning()) { start(); }
   QTime now = QTime::currentTime();
   if (first) {
     startTime = now;
     first = false;
   }
-  mutex.lock();
-  curvePending.append(CurvePoint(point, curve_id, (timestamp >= 0)?timestamp:startTime.msecsTo(now)));
-  if (waiting) {
-    pointsAvailable.wakeOne();
-  }
-  mutex.unlock();
+  trace_instant("post point");
+  post(ThreadEvent(CurvePoint(point, curve_id, (timestamp >= 0)?timestamp:startTime.msecsTo(now))));
 }
 
 void CurveThread::endOneCurve(int curve_id) {
-  addPoint(Point(CMD_END_CURVE, curve_id));
+  post(ThreadEvent(EVT_END_ONE_CURVE, curve_id));
 }
 
-void CurveThread::endCurve(int id) {
-  addPoint(Point(CMD_END, id));
+void CurveThread::endCurve(int id, int deadline) {
+  trace_instant("endCurve", id);
+  ThreadEvent event(EVT_END, id);
+  event.deadline = deadline;
+  event.posted.start(); // budget includes time spent in queue (points still to process)
+  post(event);
 }
 
 void CurveThread::loadTree(QString fileName) {
-  mutex.lock();
-  treFile = fileName;
-  mutex.unlock();
-  addPoint(Point(CMD_LOAD_TRE, 0));
+  post(ThreadEvent(EVT_LOAD_TRE, 0, fileName));
 }
 
 
 void CurveThread::stopThread() {
   if (isRunning()) {
-    addPoint(Point(CMD_QUIT, 0));
+    post(ThreadEvent(EVT_QUIT));
     this -> wait();
   }
 }
@@ -95,6 +102,7 @@ void CurveThread::waitForIdle() {
 
 void CurveThread::setMatcher(IncrementalMatch *matcher) {
   this -> matcher = matcher;
+  matcher->setInterruptFlag(&interrupt);
 }
 
 void CurveThread::setCallBack(ThreadCallBack *cb) {
@@ -104,13 +112,15 @@ void CurveThread::setCallBack(ThreadCallBack *cb) {
 void CurveThread::run() {
   logdebug(" ---"); // empty line (helps for log reading)
   logdebug_ts("Thread starting ...");
+  trace_thread_name("matcher");
   matcher->clearCurve();
-  QList<CurvePoint> inProgress;
+  QList<ThreadEvent> inProgress;
   bool started = false;
   bool tre_ok = false;
   bool tre_loaded = false;
 
-  /* bool try_aggressive_match = false; */
+  bool try_aggressive_match = false;
+  bool is_idle = false; // local copy of idle flag (avoid locking mutex for each event batch)
 
   /* statistics & counters */
   struct rusage ru_started;
@@ -123,29 +133,35 @@ void CurveThread::run() {
   forever {
     inProgress.clear();
 
-    /* critical section */
-    mutex.lock();
-    if ((curvePending.size() == 0) /* && (! try_aggressive_match) */){
-      waiting = true;
-      setIdle(! started);
-      pointsAvailable.wait(&mutex, tre_loaded?(1000 * AUTO_UNLOAD_DELAY + 5000):ULONG_MAX);
+    if (queue.isEmpty() && (! try_aggressive_match)) {
+      if (is_idle != ! started) {
+	mutex.lock();
+	setIdle(is_idle = ! started);
+	mutex.unlock();
+      }
+      queue.wait(tre_loaded?(1000 * AUTO_UNLOAD_DELAY + 5000):-1);
     }
-    waiting = false;
-    setIdle(false);
+    if (is_idle) {
+      mutex.lock();
+      setIdle(is_idle = false);
+      mutex.unlock();
+    }
+    interrupt.storeRelease(0); // all pending events are consumed below
 
-    foreach(CurvePoint p, curvePending) {
-      // make sure there is no shared information (as in QT) between these two lists
-      inProgress.append(p);
+    ThreadEvent event;
+    while (queue.pop(event)) {
+      inProgress.append(event);
     }
-    curvePending.clear();
-    mutex.unlock();
-    /* critical section end */
+
+    int lost = dropped.fetchAndStoreRelaxed(0);
+    if (lost) { logdebug("Event queue full: %d points dropped", lost); }
 
     QTime now = QTime::currentTime();
 
     if (inProgress.size() == 0 && last_activity.secsTo(now) >= (AUTO_UNLOAD_DELAY) && tre_loaded && ! started) {
       logdebug_ts("unloading tree ...");
       matcher->saveUserDict();
+      matcher->saveSnapshot(true); // next load will be a warm restore (cheap)
       matcher->loadTree(QString());
       tre_loaded = false;
       matcher->saveKeyPos(); // also save key position error stats
@@ -153,47 +169,57 @@ void CurveThread::run() {
       last_activity = now;
     }
 
-    /*
     if (inProgress.size() == 0 && try_aggressive_match) {
       // we are waiting for user points, so lets burn a few cpu cycle with the aggressive match (less efficient, but may get results sooner)
-      matcher->aggressiveMatch();
+      // this is cancelled as soon as new points are available (cf. interrupt flag)
+      float aggressive = matcher->getParamsPtr()->incr_idle_aggressive;
+      if (started && tre_ok && aggressive > 0) { matcher->aggressiveMatch(aggressive); }
       try_aggressive_match = false;
     }
-    */
 
-    /* curve points processing */
-    foreach(CurvePoint point, inProgress) {
-      /* try_aggressive_match = true; */
-      if (point.x == CMD_LOAD_TRE || ! tre_loaded) {
-	mutex.lock();
-	QString file = treFile;
-	mutex.unlock();
+    /* events processing */
+    foreach(ThreadEvent event, inProgress) {
+      if (event.type == EVT_LOAD_TRE) {
+	treFile = event.text;
+      }
 
-	logdebug_ts("loading tree: %s ...", QSTRING2PCHAR(file));
-	tre_ok = matcher->loadTree(file); // status ignored for now
+      if (event.type == EVT_LOAD_TRE || ! tre_loaded) {
+	logdebug_ts("loading tree: %s ...", QSTRING2PCHAR(treFile));
+	tre_ok = matcher->loadTree(treFile); // status ignored for now
 	matcher->clearCurve();
 	started = false; // don't block the thread with a non-idle condition :-)
 	tre_loaded = true;
       }
 
-      if (point.x == CMD_LOAD_TRE) {
+      if (event.type == EVT_LOAD_TRE) {
 	// already loaded
 
+      } else if (event.type == EVT_QUIT) {
+	matcher->saveUserDict();
+	matcher->saveSnapshot();
+	logdebug_ts("thread exiting ...");
+	mutex.lock();
+	setIdle(true);
+	mutex.unlock();
+	return;
+
       } else if (! tre_ok) {
 	// if .tre file is not loaded, none of the following will work, so just skip them
 	started = false; // don't block the thread with a non-idle condition :-)
 
-      } else if (point.x == CMD_CLEAR) {
+      } else if (event.type == EVT_CLEAR) {
 	matcher->clearCurve();
 	started = false;
 
-      } else if (point.x == CMD_END) {
-	int id = point.y;
+      } else if (event.type == EVT_END) {
+	int id = event.value;
 	logdebug_ts("Curve completed: %d", id)
 
 	t_completed = QTime::currentTime();
 	getrusage(RUSAGE_THREAD, &ru_completed);
 
+	matcher->setDeadline(event.deadline);
+	matcher->setDeadlineStart(event.posted);
 	matcher->endCurve(id);
 
 	t_matched = QTime::currentTime();
@@ -208,39 +234,33 @@ void CurveThread::run() {
 		 (float)(t_completed.msecsTo(t_matched)) / 1000);
 
 	started = false;
-	if (callback) { callback->call(matcher->getCandidatesDto()); }
-
-      } else if (point.x == CMD_QUIT) {
-	matcher->saveUserDict();
-	logdebug_ts("thread exiting ...");
-	mutex.lock();
-	setIdle(true);
-	mutex.unlock();
-	return;
-
-      } else if (point.x == CMD_LEARN) {
-	QMutexLocker locker(&learnMutex);
-
-	QListIterator<QPair<QString, int> > i(learnQueue);
-	while(i.hasNext()) {
-	  QPair<QString, int> item = i.next();
-	  matcher->learn(item.first, item.second);
+	if (callback) {
+	  TraceScope trace("callback");
+	  callback->call(matcher->getCandidatesDto(), event.deadline, matcher->isTruncated());
 	}
-	learnQueue.clear();
+	trace_checkpoint();
 
-      } else if (point.x == CMD_END_CURVE) {
-	int curve_id = point.y;
-	matcher->endOneCurve(curve_id);
+      } else if (event.type == EVT_LEARN) {
+	matcher->learn(event.text, event.value);
 
-      } else {
+      } else if (event.type == EVT_END_ONE_CURVE) {
+	matcher->endOneCurve(event.value);
+
+      } else if (event.type == EVT_POINT) {
 	if (! started) {
 	  getrusage(RUSAGE_THREAD, &ru_started);
 	}
 	started = true;
-	matcher->addPoint(point, point.curve_id);
+	matcher->addPoint(event.point, event.point.curve_id);
+	try_aggressive_match = true;
       }
     }
 
+    QList<ScenarioDto> early;
+    if (started && callback && matcher->takeProvisional(early)) {
+      TraceScope trace("provisional callback");
+      callback->provisional(early);
+    }
   }
 
 }
@@ -13,17 +13,20 @@
 #include <QThread>
 #include <QMutex>
 #include <QWaitCondition>
+#include <QAtomicInt>
 #include <QTime>
 #include <QDebug>
 
 #define AUTO_UNLOAD_DELAY 120
 
 #include "incr_match.h"
+#include "event_queue.h"
 
 class ThreadCallBack {
  public:
   virtual ~ThreadCallBack();
-  virtual void call(QList<ScenarioDto>) = 0;
+  virtual void call(QList<ScenarioDto>, int deadline, bool truncated) = 0;
+  virtual void provisional(QList<ScenarioDto>) {}; // early result while user is still drawing
 };
 
 class CurveThread : public QThread
@@ -36,7 +39,7 @@ class CurveThread : public QThread
   void clearCurve();
   void addPoint(Point point, int curve_id = -1, int timestamp = -1);
   void endOneCurve(int curve_id);
-  void endCurve(int id);
+  void endCurve(int id, int deadline = 0);
   
   void stopThread();
   void waitForIdle();
@@ -50,31 +53,26 @@ class CurveThread : public QThread
 
 protected:
   /* --- variables shared between "client" and computation thread --- */
-  bool waiting;
-  QList<CurvePoint> curvePending;
-  QWaitCondition pointsAvailable;
-  QWaitCondition idleCondition;
+  EventQueue queue; // lock-free: client never blocks on the matcher thread
+  QAtomicInt dropped; // points lost because queue was full
+  QAtomicInt interrupt; // tells matcher that new points are available (cancel speculative matching)
+
+  QWaitCondition idleCondition; // only used by waitForIdle()
   QMutex mutex;
   bool idle;
-  QString treFile;
-	     
-  QMutex learnMutex;
-  QList<QPair<QString, int> > learnQueue;
   /* --- end of shared variables --- */
 
   IncrementalMatch *matcher;
   ThreadCallBack *callback;
   QTime startTime;
   bool first;
+  QString treFile; // only used by computation thread (reload after auto-unload)
 
+  void post(const ThreadEvent &event);
   void run();
   void setIdle(bool);
 };
 
-enum thread_cmd_t {
-  CMD_END = -1001, CMD_CLEAR = -1002, CMD_QUIT = -1003, CMD_LOAD_TRE = - 1004, CMD_LEARN = - 1005, CMD_END_CURVE = - 1006
-};
-
 #endif /* THREAD */
 
 #endif /* THREAD_H */
@@ -0,0 +1,159 @@
+#include "trace.h"
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QElapsedTimer>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "log.h"
+
+#define TRACE_BUFFER_MASK (TRACE_BUFFER_SIZE - 1)
+#define TRACE_MAX_THREADS 32
+
+int trace_enabled = 0;
+
+typedef struct {
+  QAtomicInt seq; // 0 = being written, else event number + 1
+  const char *name;
+  char phase;
+  int tid;
+  int arg;
+  qint64 ts;
+  qint64 dur;
+} trace_slot_t;
+
+static trace_slot_t ring[TRACE_BUFFER_SIZE];
+static QAtomicInt next_event;
+
+static QMutex mutex; // protects everything below (never used when recording events)
+static QString traceFile;
+static QElapsedTimer last_dump;
+static int thread_ids[TRACE_MAX_THREADS];
+static const char *thread_names[TRACE_MAX_THREADS];
+static int thread_count = 0;
+
+static __thread int current_tid = 0;
+
+static int get_tid() {
+  if (! current_tid) { current_tid = (int) syscall(SYS_gettid); }
+  return current_tid;
+}
+
+qint64 trace_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (qint64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void trace_event(const char *name, char phase, qint64 ts, qint64 dur, int arg) {
+  if (! trace_enabled) { return; }
+  int n = next_event.fetchAndAddOrdered(1);
+  trace_slot_t *slot = &ring[n & TRACE_BUFFER_MASK];
+  slot->seq.storeRelease(0);
+  slot->name = name;
+  slot->phase = phase;
+  slot->tid = get_tid();
+  slot->arg = arg;
+  slot->ts = ts;
+  slot->dur = dur;
+  slot->seq.storeRelease(n + 1);
+}
+
+void trace_instant(const char *name, int arg) {
+  if (! trace_enabled) { return; }
+  trace_event(name, 'i', trace_now(), 0, arg);
+}
+
+void trace_thread_name(const char *name) {
+  if (! trace_enabled) { return; }
+  QMutexLocker locker(&mutex);
+  int tid = get_tid();
+  for(int i = 0; i < thread_count; i ++) {
+    if (thread_ids[i] == tid) { thread_names[i] = name; return; }
+  }
+  if (thread_count >= TRACE_MAX_THREADS) { return; }
+  thread_ids[thread_count] = tid;
+  thread_names[thread_count] = name;
+  thread_count ++;
+}
+
+void trace_dump() {
+  /* write the whole ring buffer (this may be called while events are still
+     being recorded: slots modified during the copy are skipped) */
+  if (! trace_enabled) { return; }
+  QMutexLocker locker(&mutex);
+
+  FILE *f = fopen(QSTRING2PCHAR(traceFile), "w");
+  if (! f) { logdebug("Can't write trace file: %s", QSTRING2PCHAR(traceFile)); return; }
+
+  int pid = getpid();
+  fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  bool first = true;
+  for(int i = 0; i < thread_count; i ++) {
+    fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+	    first?"":",\n", pid, thread_ids[i], thread_names[i]);
+    first = false;
+  }
+
+  int last = next_event.loadAcquire();
+  int start = last - TRACE_BUFFER_SIZE;
+  if (start < 0) { start = 0; }
+  for(int n = start; n < last; n ++) {
+    trace_slot_t *slot = &ring[n & TRACE_BUFFER_MASK];
+    if (slot->seq.loadAcquire() != n + 1) { continue; }
+    trace_slot_t e;
+    e.name = slot->name;
+    e.phase = slot->phase;
+    e.tid = slot->tid;
+    e.arg = slot->arg;
+    e.ts = slot->ts;
+    e.dur = slot->dur;
+    if (slot->seq.loadAcquire() != n + 1) { continue; } // overwritten while reading
+
+    fprintf(f, "%s{\"name\": \"%s\", \"ph\": \"%c\", \"pid\": %d, \"tid\": %d, \"ts\": %lld",
+	    first?"":",\n", e.name, e.phase, pid, e.tid, (long long) e.ts);
+    if (e.phase == 'X') { fprintf(f, ", \"dur\": %lld", (long long) e.dur); }
+    if (e.phase == 'i') { fprintf(f, ", \"s\": \"t\""); }
+    fprintf(f, ", \"args\": {\"n\": %d}}", e.arg);
+    first = false;
+  }
+  fprintf(f, "\n]}\n");
+  fclose(f);
+
+  last_dump.start();
+}
+
+void trace_checkpoint() {
+  if (! trace_enabled) { return; }
+  {
+    QMutexLocker locker(&mutex);
+    if (last_dump.isValid() && last_dump.elapsed() < TRACE_DUMP_INTERVAL) { return; }
+  }
+  trace_dump();
+}
+
+static void trace_exit() {
+  trace_dump();
+}
+
+void trace_start(QString fileName) {
+  QMutexLocker locker(&mutex);
+  if (! trace_enabled) { atexit(trace_exit); }
+  traceFile = fileName;
+  last_dump.start();
+  trace_enabled = 1;
+}
+
+static int trace_init() {
+  char *fileName = getenv("OKB_TRACE");
+  if (fileName && *fileName) { trace_start(QString(fileName)); }
+  return 0;
+}
+
+static int trace_init_done = trace_init();
@@ -0,0 +1,43 @@
+/* optional timeline tracing: begin/end of interesting events (point
+   ingestion, matching iterations, fallback, callbacks ...) are recorded in
+   a ring buffer (only the last TRACE_BUFFER_SIZE events are kept), and
+   dumped in Chrome trace-event JSON format (open it with chrome://tracing
+   or https://ui.perfetto.dev).
+
+   Tracing is enabled with OKB_TRACE environment variable (output file name)
+   or trace_start() (e.g. cli -T option). When disabled, a trace point only
+   costs a test on a global variable.
+   Event names must be static strings (only the pointer is stored) */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <QtGlobal>
+
+#define TRACE_BUFFER_SIZE 16384 // must be a power of 2
+#define TRACE_DUMP_INTERVAL 5000 // ms (see trace_checkpoint)
+
+extern int trace_enabled;
+
+void trace_start(QString fileName);
+qint64 trace_now(); // microseconds (monotonic clock)
+void trace_event(const char *name, char phase, qint64 ts, qint64 dur = 0, int arg = 0);
+void trace_instant(const char *name, int arg = 0);
+void trace_thread_name(const char *name);
+void trace_dump();
+void trace_checkpoint(); // dump trace if it has not been done recently
+
+/* records a "complete" event (begin time + duration) for current scope */
+class TraceScope {
+ private:
+  const char *name;
+  qint64 start;
+  int arg;
+ public:
+  TraceScope(const char *name, int arg = 0) : name(name), arg(arg) { start = trace_enabled?trace_now():-1; }
+  ~TraceScope() { if (start >= 0) { trace_event(name, 'X', start, trace_now() - start, arg); } }
+  void setArg(int value) { arg = value; }
+};
+
+#endif /* TRACE_H */
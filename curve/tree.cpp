@@ -7,10 +7,36 @@ using namespace std;
 
 LetterTree::LetterTree() {
   data = NULL;
+  map_file = NULL;
+}
+
+LetterTree::LetterTree(const LetterTree &from) {
+  /* deep copy (used for copy-on-write when learning new words) */
+  data = NULL;
+  map_file = NULL;
+  length = from.length;
+  alloc = from.alloc;
+  new_index = from.new_index;
+  dirty = from.dirty;
+  if (from.data) {
+    data = new unsigned char[alloc];
+    memcpy(data, from.data, alloc);
+  }
 }
 
 LetterTree::~LetterTree() {
-  if (data) { delete[] data; }
+  release();
+}
+
+void LetterTree::release() {
+  if (map_file) {
+    if (data) { map_file -> unmap(data); }
+    delete map_file;
+    map_file = NULL;
+  } else if (data) {
+    delete[] data;
+  }
+  data = NULL;
 }
 
 LetterNode LetterTree::getRoot() {
@@ -22,10 +48,7 @@ LetterNode LetterTree::getRoot() {
 }
 
 bool LetterTree::loadFromFile(QString fileName) {
-  if (data) {
-    delete[] data;
-    data = NULL;
-  }
+  release();
 
   if (fileName.isEmpty()) {
     return true;
@@ -53,6 +76,33 @@ bool LetterTree::loadFromFile(QString fileName) {
   return false;
 }
 
+bool LetterTree::mapFromFile(QString fileName, qint64 offset, int length, int used_size) {
+  /* use tree data from a (warm restore) snapshot file without reading it:
+     pages are only loaded when needed. Mapped data is never modified
+     (learning new words always works on a copy, cf. MatchEngine) */
+  release();
+
+  map_file = new QFile(fileName);
+  if (map_file -> open(QFile::ReadOnly) && map_file -> size() >= offset + used_size) {
+    data = map_file -> map(offset, used_size);
+  }
+  if (! data) {
+    release();
+    return false;
+  }
+
+  this -> length = length;
+  this -> alloc = used_size;
+  this -> dirty = false;
+  this -> new_index = used_size >> 2;
+  return true;
+}
+
+int LetterTree::getUsedSize() {
+  int size = 4 * new_index;
+  return (size < alloc)?size:alloc;
+}
+
 void LetterTree::dump() {
   dump("", getRoot());
 }
@@ -121,13 +171,13 @@ void LetterTree::setPayload(unsigned char *key, void* value, int len) {
   if (strlen((char*) key) < 2) { return; }
   if (len >= 255) { return; }
 
-  // allocate a larger buffer if needed
+  // allocate a larger buffer if needed (mapped data is read-only)
   int min_size = new_index * 4 + 256 * strlen((char *)key) + len + 1000;
-  if (alloc < min_size) {
-    int new_alloc = min_size;
+  if (alloc < min_size || map_file) {
+    int new_alloc = (alloc < min_size)?min_size:alloc;
     unsigned char *new_data = new unsigned char[new_alloc];
     memcpy(new_data, data, alloc);
-    delete[] data;
+    release();
 
     data = new_data;
     alloc = new_alloc;
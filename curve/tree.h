@@ -28,15 +28,24 @@ class LetterTree {
   int alloc;
   int new_index;
   bool dirty;
+  QFile *map_file; // set if data is mapped from a snapshot file (read-only)
 
+  LetterTree& operator=(const LetterTree &from); // not implemented (trees are shared by pointer)
+
+  void release();
   void dump(QString prefix, LetterNode node);
   int setPayloadRec(unsigned char *key, void* payload, int len, int index);
   int addPayloadValue(void* value, int len);
   
  public:
   LetterTree();
+  LetterTree(const LetterTree &from);
   ~LetterTree();
   bool loadFromFile(QString fileName);
+  bool mapFromFile(QString fileName, qint64 offset, int length, int used_size);
+  const unsigned char *getData() { return data; }
+  int getLength() { return length; }
+  int getUsedSize(); // including payloads added after loading
   LetterNode getRoot();
   void dump();
   QPair<void*, int> getPayload(unsigned char *key);
@@ -61,6 +70,7 @@ class LetterNode {
   bool isLeaf();
   QPair<void*, int> getPayload();
   bool hasPayload();
+  int getIndex() { return index; }
   QString toString();
 };
 
@@ -0,0 +1,349 @@
+/* synthetic gesture generator: build plausible gestures from a word list
+   and a keyboard layout, for load testing and accuracy measurements with
+   any amount of gestures (and any dictionary size).
+   Output is a binary gesture file (cf. replay.h), which can be replayed by
+   cli or curvebench.
+
+   Gesture model:
+   - path goes through key centres (moved by a random error for each key)
+   - corners are cut (quadratic Bezier curve around each intermediate key)
+   - speed follows a minimum-jerk profile between keys (slow down around
+     keys, accelerate in between), with a random global speed factor
+   - points are sampled at a fixed rate, with a random jitter
+   - optionally, the word is split in two curves drawn by two fingers
+     (multi-touch swipe) */
+
+#include "config.h"
+#include "scenario.h"
+#include "functions.h"
+#include "replay.h"
+
+#include <QString>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <QTextStream>
+#include <QTextCodec>
+#include <QStringList>
+#include <QRegExp>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+
+#include <iostream>
+using namespace std;
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <math.h>
+
+typedef struct {
+  float key_error; // key position error (ratio of key width, standard deviation)
+  float jitter; // points jitter (pixels, standard deviation)
+  float corner; // corner cutting (ratio of adjacent segments length, max 0.5)
+  float speed; // average speed (pixels / s)
+  float speed_var; // random speed factor (+/- ratio)
+  int key_time; // extra time spent around each key (ms)
+  int sample; // time between points (ms)
+  float multi; // probability of a two-finger gesture
+} gen_params_t;
+
+static void usage(char *progname) {
+  cout << "usage:" << endl;
+  cout << progname << " [<options>] <layout json> <word list> <output>" << endl;
+  cout << "layout: list of keys (same format as \"keys\" in test files, which can be used directly)" << endl;
+  cout << "word list: one word per line, optionally followed by a count (used as weight with -n)" << endl;
+  cout << "options:" << endl;
+  cout << " -n <count> : number of gestures (random words), default: each word once" << endl;
+  cout << " -s <seed> : random seed" << endl;
+  cout << " -e <ratio> : key position error, as a ratio of key width (default: 0.15)" << endl;
+  cout << " -j <pixels> : points jitter (default: 2)" << endl;
+  cout << " -c <ratio> : corner cutting, from 0 to 0.5 (default: 0.2)" << endl;
+  cout << " -v <pixels/s> : average speed (default: 1500)" << endl;
+  cout << " -V <ratio> : speed variability (default: 0.3)" << endl;
+  cout << " -k <ms> : extra time around each key (default: 20)" << endl;
+  cout << " -i <ms> : sampling interval (default: 10)" << endl;
+  cout << " -m <ratio> : probability of two-finger gestures (default: 0)" << endl;
+  cout << " -p <file> : parameters (JSON) stored with gestures" << endl;
+  cout << " -t <name> : tree file name stored with gestures (e.g. en.tre)" << endl;
+  exit(1);
+}
+
+static float gauss(float sigma) {
+  /* Box-Muller transform */
+  if (sigma <= 0) { return 0; }
+  double u1 = drand48(), u2 = drand48();
+  if (u1 < 1e-12) { u1 = 1e-12; }
+  return sigma * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+typedef struct {
+  float x, y;
+} fpoint_t;
+
+class Path {
+  /* polyline with cumulative length, and length at each key */
+ public:
+  QVector<fpoint_t> pts;
+  QVector<float> len;
+  QVector<float> key_len;
+
+  void add(float x, float y) {
+    fpoint_t p = { x, y };
+    float l = 0;
+    if (pts.size()) {
+      fpoint_t &last = pts[pts.size() - 1];
+      l = len[len.size() - 1] + sqrt((x - last.x) * (x - last.x) + (y - last.y) * (y - last.y));
+    }
+    pts.append(p);
+    len.append(l);
+  }
+  float length() { return len.size()?len[len.size() - 1]:0; }
+
+  fpoint_t at(float l) {
+    /* point at given length (binary search + linear interpolation) */
+    int a = 0, b = pts.size() - 1;
+    if (l <= 0 || b <= 0) { return pts[0]; }
+    if (l >= len[b]) { return pts[b]; }
+    while (b - a > 1) {
+      int m = (a + b) / 2;
+      if (len[m] <= l) { a = m; } else { b = m; }
+    }
+    float r = (len[b] > len[a])?(l - len[a]) / (len[b] - len[a]):0;
+    fpoint_t p = { pts[a].x + r * (pts[b].x - pts[a].x), pts[a].y + r * (pts[b].y - pts[a].y) };
+    return p;
+  }
+};
+
+static void buildPath(const QList<fpoint_t> &keys, float corner, Path &path) {
+  /* straight lines between keys, with a quadratic Bezier curve around each
+     intermediate key (it starts and ends at a ratio "corner" of adjacent
+     segments) */
+  int n = keys.size();
+  path.add(keys[0].x, keys[0].y);
+  path.key_len.append(0);
+  for (int i = 1; i < n; i ++) {
+    fpoint_t k = keys[i];
+    if (i == n - 1 || corner <= 0) {
+      path.add(k.x, k.y);
+      path.key_len.append(path.length());
+      continue;
+    }
+    fpoint_t prev = keys[i - 1], next = keys[i + 1];
+    fpoint_t p1 = { k.x + corner * (prev.x - k.x), k.y + corner * (prev.y - k.y) };
+    fpoint_t p2 = { k.x + corner * (next.x - k.x), k.y + corner * (next.y - k.y) };
+    path.add(p1.x, p1.y);
+    int steps = 16;
+    for (int j = 1; j <= steps; j ++) {
+      float t = (float) j / steps;
+      float a = (1 - t) * (1 - t), b = 2 * t * (1 - t), c = t * t;
+      path.add(a * p1.x + b * k.x + c * p2.x, a * p1.y + b * k.y + c * p2.y);
+      if (j == steps / 2) { path.key_len.append(path.length()); } // closest point to the key
+    }
+  }
+}
+
+static int drawCurve(const QList<fpoint_t> &keys, int curve_id, int t0, const gen_params_t &gp,
+		     QList<CurvePoint> &result) {
+  /* sample one curve (returns its end time) */
+  Path path;
+  buildPath(keys, gp.corner, path);
+
+  float speed = gp.speed * (1 + gp.speed_var * (2 * drand48() - 1));
+  if (speed < 50) { speed = 50; }
+
+  // time spent for each segment between keys
+  QList<float> seg_time;
+  float total = 0;
+  for (int i = 1; i < path.key_len.size(); i ++) {
+    float tm = gp.key_time + 1000 * (path.key_len[i] - path.key_len[i - 1]) / speed;
+    seg_time.append(tm);
+    total += tm;
+  }
+  if (seg_time.isEmpty()) { // single key: a short "tap"
+    seg_time.append(gp.key_time + 3 * gp.sample);
+    total = seg_time[0];
+  }
+
+  int seg = 0;
+  float seg_start = 0;
+  for (float t = 0; ; t += gp.sample) {
+    if (t > total) { t = total; }
+    while (seg < seg_time.size() - 1 && t > seg_start + seg_time[seg]) { seg_start += seg_time[seg]; seg ++; }
+
+    // minimum-jerk profile for current segment
+    float tau = seg_time[seg]?(t - seg_start) / seg_time[seg]:1;
+    if (tau > 1) { tau = 1; }
+    float s = tau * tau * tau * (10 - 15 * tau + 6 * tau * tau);
+    float l0 = path.key_len[seg];
+    float l1 = (seg + 1 < path.key_len.size())?path.key_len[seg + 1]:l0;
+    fpoint_t p = path.at(l0 + s * (l1 - l0));
+
+    CurvePoint cp(Point((int) (p.x + gauss(gp.jitter) + 0.5), (int) (p.y + gauss(gp.jitter) + 0.5)),
+		  curve_id, t0 + (int) t);
+    result.append(cp);
+    if (t >= total) { break; }
+  }
+
+  return t0 + (int) total;
+}
+
+static bool cmpTime(const CurvePoint &p1, const CurvePoint &p2) {
+  return p1.t < p2.t;
+}
+
+static bool generate(QString word, const QHash<unsigned char, Key> &layout, const gen_params_t &gp,
+		     QList<CurvePoint> &curve) {
+  QString letters = word2letter(word);
+  QList<fpoint_t> keys;
+  for (int i = 0; i < letters.length(); i ++) {
+    unsigned char letter = letters.at(i).cell();
+    if (! layout.contains(letter)) { return false; }
+    Key k = layout[letter];
+    fpoint_t p = { k.x + gauss(gp.key_error * k.width), k.y + gauss(gp.key_error * k.height) };
+    keys.append(p);
+  }
+  if (keys.isEmpty()) { return false; }
+
+  curve.clear();
+  if (keys.size() >= 4 && drand48() < gp.multi) {
+    // two fingers: second one starts a bit before the first one ends
+    int split = 2 + (int) (drand48() * (keys.size() - 3));
+    int end1 = drawCurve(keys.mid(0, split), 0, 0, gp, curve);
+    QList<CurvePoint> curve2;
+    int end2 = drawCurve(keys.mid(split), 1, end1 - 2 * gp.sample, gp, curve2);
+    curve.append(EndMarker(0));
+    curve.last().t = end1;
+    curve.append(curve2);
+    qStableSort(curve.begin(), curve.end(), cmpTime);
+    curve.append(EndMarker(1));
+    curve.last().t = end2;
+  } else {
+    drawCurve(keys, 0, 0, gp, curve);
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  gen_params_t gp;
+  gp.key_error = 0.15;
+  gp.jitter = 2;
+  gp.corner = 0.2;
+  gp.speed = 1500;
+  gp.speed_var = 0.3;
+  gp.key_time = 20;
+  gp.sample = 10;
+  gp.multi = 0;
+
+  int count = 0;
+  QString paramsFile;
+  QString treeFile;
+
+  extern char *optarg;
+  extern int optind;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:s:e:j:c:v:V:k:i:m:p:t:")) != -1) {
+    switch (c) {
+    case 'n': count = atoi(optarg); break;
+    case 's': srand48(atol(optarg)); break;
+    case 'e': gp.key_error = atof(optarg); break;
+    case 'j': gp.jitter = atof(optarg); break;
+    case 'c': gp.corner = min(0.5, atof(optarg)); break;
+    case 'v': gp.speed = atof(optarg); break;
+    case 'V': gp.speed_var = atof(optarg); break;
+    case 'k': gp.key_time = atoi(optarg); break;
+    case 'i': gp.sample = max(1, atoi(optarg)); break;
+    case 'm': gp.multi = atof(optarg); break;
+    case 'p': paramsFile = optarg; break;
+    case 't': treeFile = optarg; break;
+    default: usage(argv[0]); break;
+    }
+  }
+  if (argc != optind + 3) { usage(argv[0]); }
+
+  // keyboard layout
+  QFile layoutFile(argv[optind]);
+  if (! layoutFile.open(QFile::ReadOnly)) { cerr << "Can't open: " << argv[optind] << endl; return 1; }
+  QJsonDocument doc = QJsonDocument::fromJson(layoutFile.readAll());
+  layoutFile.close();
+  QJsonArray json_keys;
+  if (doc.isArray()) {
+    json_keys = doc.array();
+  } else {
+    QJsonObject json = doc.object();
+    if (json.contains("input")) { json = json["input"].toObject(); }
+    json_keys = json["keys"].toArray();
+  }
+  QList<Key> keys;
+  QHash<unsigned char, Key> layout;
+  foreach(QJsonValue json_key, json_keys) {
+    Key k = Key::fromJson(json_key.toObject());
+    keys.append(k);
+    if (k.letter) { layout[k.letter] = k; }
+  }
+  if (layout.isEmpty()) { cerr << "No keys found in layout" << endl; return 1; }
+
+  // word list
+  QFile wordFile(argv[optind + 1]);
+  if (! wordFile.open(QFile::ReadOnly)) { cerr << "Can't open: " << argv[optind + 1] << endl; return 1; }
+  QList<QString> words;
+  QList<double> weights; // cumulative
+  double total_weight = 0;
+  QTextStream in(&wordFile);
+  in.setCodec(QTextCodec::codecForName("UTF-8"));
+  QString line = in.readLine();
+  while (! line.isNull()) {
+    QStringList fields = line.trimmed().split(QRegExp("\\s+"));
+    if (! fields[0].isEmpty()) {
+      words.append(fields[0]);
+      total_weight += (fields.size() > 1)?max(0.0, fields[1].toDouble()):1;
+      weights.append(total_weight);
+    }
+    line = in.readLine();
+  }
+  wordFile.close();
+  if (words.isEmpty() || total_weight <= 0) { cerr << "Empty word list" << endl; return 1; }
+
+  // parameters
+  QJsonObject json_params;
+  if (! paramsFile.isEmpty()) {
+    QFile file(paramsFile);
+    if (! file.open(QFile::ReadOnly)) { cerr << "Can't open: " << paramsFile.toUtf8().constData() << endl; return 1; }
+    json_params = QJsonDocument::fromJson(file.readAll()).object();
+    file.close();
+  }
+
+  ReplayWriter writer;
+  if (! writer.open(argv[optind + 2])) { cerr << "Can't write: " << argv[optind + 2] << endl; return 1; }
+  int params = writer.addParams(json_params);
+
+  bool all_words = (count <= 0);
+  if (all_words) { count = words.size(); }
+  int skipped = 0;
+  for (int i = 0; i < count; i ++) {
+    QString word;
+    if (all_words) {
+      word = words[i];
+    } else {
+      // weighted random choice
+      double r = drand48() * total_weight;
+      int a = 0, b = weights.size() - 1;
+      while (a < b) {
+	int m = (a + b) / 2;
+	if (weights[m] <= r) { a = m + 1; } else { b = m; }
+      }
+      word = words[a];
+    }
+
+    QList<CurvePoint> curve;
+    if (! generate(word, layout, gp, curve)) { skipped ++; continue; }
+    writer.add(params, keys, curve, i, QString("gen-%1").arg(i), word, treeFile);
+  }
+
+  int written = writer.getCount();
+  if (! writer.close()) { cerr << "Error writing: " << argv[optind + 2] << endl; return 1; }
+  cerr << "Generated " << written << " gestures (skipped: " << skipped << ")" << endl;
+  return 0;
+}
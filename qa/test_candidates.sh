@@ -0,0 +1,101 @@
+#! /bin/bash -e
+# before/after test for matching changes: run the test suite with a
+# reference configuration (other cli build and/or parameters) and with the
+# current one, then compare candidates for each test case
+#
+# e.g. compare with a build of the previous commit:
+#   qa/test_candidates.sh -c /tmp/okb-prev/cli/build/cli
+# or compare parameter values with the current build:
+#   qa/test_candidates.sh -P key_pass=0 -p key_pass=1
+#
+# it fails if less expected words are ranked first than with the reference
+# (or if any candidate list has changed, with -s option: for changes which
+# must not affect results, e.g. pure optimizations)
+
+usage() {
+    echo "usage: $(basename "$0") [-s] [-c <reference cli>] [-P <reference params>] [-p <params>] [<test dir> ...]"
+    echo "  params are comma separated lists: key1=value1,key2=value2"
+    exit 1
+}
+
+ref_cli=
+ref_params=
+params=
+strict=
+while getopts "sc:P:p:h" opt ; do
+    case "$opt" in
+	s) strict=1 ;;
+	c) ref_cli="$(readlink -f "$OPTARG")" ;;
+	P) ref_params="$OPTARG" ;;
+	p) params="$OPTARG" ;;
+	*) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+[ -z "$ref_cli" -a -z "$ref_params" -a -z "$params" ] && usage
+
+test_dirs=
+for d in "$@" ; do test_dirs="$test_dirs${test_dirs:+,}$(readlink -f "$d")" ; done
+
+cd "$(dirname "$0")/.."
+
+. tools/env.sh
+
+tmp="$(mktemp -d "/tmp/$(basename "$0" .sh).XXXXXX")"
+echo "Work directory: $tmp"
+
+run() {
+    local dir="$1"
+    local cli="$2"
+    local p="$3"
+    mkdir "$tmp/$dir"
+    OKB_CLI="$cli" tools/test.py -n -g -t guess -d "$tmp/$dir" ${p:+-p "$p"} ${test_dirs:+-T "$test_dirs"} | grep -v '^###' || true
+}
+
+# same conversion as tools/optim.py
+word2letters() {
+    python3 -c 'import sys, unicodedata; print("".join(c for c in unicodedata.normalize("NFD", sys.argv[1]) if unicodedata.category(c) != "Mn"))' "$1" | tr 'A-Z' 'a-z' | tr -cd 'a-z' | tr -s 'a-z'
+}
+
+# candidates sorted by score (best first)
+candidates() {
+    sort -k2,2 -g -r "$1" | awk '{ print $1 }' | tr '\n' ' '
+}
+
+echo "Reference: ${ref_cli:-current cli} ${ref_params}"
+run ref "${ref_cli:-$(readlink -f cli/build/cli)}" "$ref_params"
+echo "Current: ${params}"
+run cur "$(readlink -f cli/build/cli)" "$params"
+
+# --- compare ---
+changed=0
+ref_ok=0
+cur_ok=0
+for f in "$tmp"/ref/*.out ; do
+    id="$(basename "$f" .out)"
+    word="$(cat "$tmp/ref/$id.word")"
+    c1="$(candidates "$f")"
+    c2="$(candidates "$tmp/cur/$id.out")"
+    first1="${c1%% *}"
+    first2="${c2%% *}"
+    [ "$(word2letters "$first1")" = "$word" ] && ref_ok=$((ref_ok + 1))
+    [ "$(word2letters "$first2")" = "$word" ] && cur_ok=$((cur_ok + 1))
+    if [ "$c1" != "$c2" ] ; then
+	changed=$((changed + 1))
+	echo "$id [$word]: $first1 -> $first2"
+	echo "    ref: $c1"
+	echo "    cur: $c2"
+    fi
+done
+
+echo "Changed: $changed - expected word first: $ref_ok -> $cur_ok"
+
+if [ "$cur_ok" -lt "$ref_ok" ] || [ -n "$strict" -a "$changed" -gt 0 ] ; then
+    echo "*Test failed*"
+    exit 1
+fi
+
+echo "Success \o/"
+
+rm -rf "$tmp" # only on success
@@ -0,0 +1,62 @@
+#! /bin/bash -e
+# check early (provisional) results on the test suite: run each test case
+# with incremental matching and a given early_score_gap, and check that
+# provisional results are confirmed by the final result (best candidate is
+# in the provisional list) and that they are not sent again for the same
+# prefix (less provisional results than letters in the expected word)
+#
+# usage: qa/test_early.sh [-g <early_score_gap>] [-m <min confirmed ratio>] [<test dir> ...]
+
+gap=0.1
+min_ratio=0.9
+while getopts "g:m:h" opt ; do
+    case "$opt" in
+	g) gap="$OPTARG" ;;
+	m) min_ratio="$OPTARG" ;;
+	*) echo "usage: $(basename "$0") [-g <early_score_gap>] [-m <min confirmed ratio>] [<test dir> ...]" ; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+test_dirs=
+for d in "${@:-test}" ; do test_dirs="$test_dirs $(readlink -f "$d")" ; done
+
+cd "$(dirname "$0")/.."
+
+. tools/env.sh
+
+if ! python3 - "$gap" "$min_ratio" $test_dirs <<'PYEOF' ; then
+import sys, os, json, subprocess
+sys.path.insert(0, "tools")
+import optim
+os.chdir("tools") # same relative paths as tools/test.py
+
+gap, min_ratio = float(sys.argv[1]), float(sys.argv[2])
+params = optim.params
+params["early_score_gap"]["value"] = gap
+
+early = confirmed = resent = 0
+for test_dir in sys.argv[3:]:
+    for (word, json_in, lang, test_id) in optim.load_tests(test_dir):
+        json_in = optim.update_json(json_in, params)
+        cmd = [ "cli", "-a", "1", "-g", os.path.join(optim.TRE_DIR, "%s.tre" % lang) ]
+        out = subprocess.run(cmd, input = json_in.encode("utf-8"), stdout = subprocess.PIPE, stderr = subprocess.DEVNULL, check = True).stdout.decode("utf-8")
+        result = [ json.loads(li[8:]) for li in out.split("\n") if li.startswith("Result: ") ][0]
+        st = result["stats"]
+        if not st["early"]: continue
+        early += 1
+        if st["early_ok"]: confirmed += 1
+        else: print("%s [%s]: provisional result amended" % (test_id, word))
+        if st["early"] > len(word):
+            resent += 1
+            print("%s [%s]: %d provisional results sent" % (test_id, word, st["early"]))
+
+ratio = confirmed / early if early else 1
+print("Provisional results: %d - confirmed: %d (%.1f%%) - sent again: %d" % (early, confirmed, 100. * ratio, resent))
+if ratio < min_ratio or resent: exit(1)
+PYEOF
+    echo "*Test failed*"
+    exit 1
+fi
+
+echo "Success \o/"
@@ -0,0 +1,7 @@
+#! /bin/bash -e
+# key pass index is only an optimization: check that it does not change
+# any result on the test suite (candidates with key_pass on and off)
+#
+# usage: qa/test_key_pass.sh [<test dir> ...]
+
+exec "$(dirname "$0")/test_candidates.sh" -s -P key_pass=0 -p key_pass=1 "$@"
@@ -0,0 +1,18 @@
+#! /bin/bash -e
+# latency benchmark: replay all test cases with original points timing
+# usage: bench.sh [<options>] (e.g. "-x 0" for no delay, "-o bench.json" to save results)
+# run "bench/build/curvebench" without arguments for all options
+# regression gate: "bench.sh -x 0 -r 5 -o base.json" and "bench_compare.py -u perf.db base.json" before
+# engine changes, then "bench.sh -x 0 -r 5 -o new.json" and "bench_compare.py perf.db new.json"
+
+dir=`dirname "$0"`"/.."
+dir=`readlink -f "$dir"`
+
+pushd "$dir/bench" > /dev/null
+if [ ! -f "Makefile" ] || [ "Makefile" -ot "bench.pro" ] ; then
+    qtchooser --run-tool=qmake -qt=5
+fi
+make -j$(getconf _NPROCESSORS_ONLN) > /dev/null
+popd > /dev/null
+
+"$dir/bench/build/curvebench" "$@" "$dir/db" "$dir/test/"*.json
@@ -0,0 +1,187 @@
+#! /usr/bin/python3
+# -*- coding: utf-8 -*-
+
+# performance regression gate: compare curvebench results (JSON output,
+# preferably with repeated runs, e.g. "tools/bench.sh -x 0 -r 5 -o new.json")
+# with a stored baseline
+#
+# For each metric, the global change is the geometric mean of per-file
+# ratios, with its 95% confidence interval. A regression is detected if the
+# whole interval is above the threshold.
+#
+# Per-file changes (Welch's t-test on repeated runs, reported if the 95%
+# confidence interval of the difference does not include 0 and the change
+# is larger than the threshold) are only listed for information: with
+# hundreds of files and several metrics, some of them are always
+# "significant" by chance, so they are not used for the gate.
+#
+# Exit code is 1 if a regression is detected, so this can be used as a gate
+# before merging engine changes
+
+import os, sys
+import json
+import math
+import pickle
+import getopt
+
+METRICS = [ "latency", "cputime", "count" ]
+THRESHOLD = 0.05  # minimum relative change to report
+MIN_ABS = { "latency": 1, "cputime": 1, "count": 1 }  # minimum absolute change (ms or nodes)
+
+# Student's t distribution: 97.5% quantiles (two-sided 95% interval)
+T975 = [ None, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+         2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+         2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 ]
+
+def t975(df):
+    if df < 1: return float("inf")
+    df = int(df)
+    if df < len(T975): return T975[df]
+    return 1.96
+
+def mean(l):
+    return sum(l) / len(l)
+
+def var(l):
+    if len(l) < 2: return 0.
+    m = mean(l)
+    return sum([ (x - m) ** 2 for x in l ]) / (len(l) - 1)
+
+def welch(a, b):
+    """ difference of means (b - a) with its 95% confidence interval """
+    d = mean(b) - mean(a)
+    if len(a) < 2 or len(b) < 2: return d, float("-inf"), float("inf")  # no variance estimate
+    va, vb = var(a) / len(a), var(b) / len(b)
+    se = math.sqrt(va + vb)
+    if se == 0: return d, d, d  # deterministic metric (e.g. node count)
+    df = (va + vb) ** 2 / (va ** 2 / (len(a) - 1) + vb ** 2 / (len(b) - 1))
+    h = t975(df) * se
+    return d, d - h, d + h
+
+def load_bench(fname):
+    """ curvebench JSON output -> { file: { metric: [ values ] } } """
+    js = json.loads(open(fname).read())
+    result = dict()
+    for g in js["gestures"]:
+        key = "%s:%s" % (g.get("treefile", ""), g["file"])
+        r = result.setdefault(key, dict([ (m, []) for m in METRICS ]))
+        for m in METRICS: r[m].append(float(g[m]))
+    return result, js.get("options", dict())
+
+class Color:
+    def __init__(self, color_ok):
+        self.color_ok = color_ok
+
+    def text(self, txt, good):
+        if self.color_ok: return "\x1b[1;%dm%s\x1b[0m" % (32 if good else 31, txt)
+        return ("[+]" if good else "[-]") + txt
+
+def compare(base, new, color, verbose = False):
+    regressions = []  # global only
+    slower, faster = [], []  # per file (information)
+    summary = []
+
+    for m in METRICS:
+        logratios = []
+        for key in sorted(new.keys()):
+            if key not in base: continue
+            a, b = base[key][m], new[key][m]
+            if not a or not b: continue
+            ma = mean(a)
+            d, lo, hi = welch(a, b)
+            if ma > 0 and mean(b) > 0: logratios.append(math.log(mean(b) / ma))
+
+            rel = d / ma if ma else 0
+            significant = (lo > 0 or hi < 0)
+            if not significant or abs(rel) < THRESHOLD or abs(d) < MIN_ABS[m]:
+                if verbose: print("  %-40s %-8s %10.2f -> %10.2f (%+.1f%%) [%.2f, %.2f]" % (key, m, ma, mean(b), 100 * rel, lo, hi))
+                continue
+
+            line = "%-40s %-8s %10.2f -> %10.2f (%+.1f%%, 95%% CI of difference: [%.2f, %.2f])" % (key, m, ma, mean(b), 100 * rel, lo, hi)
+            if d > 0: slower.append(line)
+            else: faster.append(line)
+
+        if logratios:
+            # global change: geometric mean of per-file ratios, with t-interval on log ratios
+            g = mean(logratios)
+            h = t975(len(logratios) - 1) * math.sqrt(var(logratios) / len(logratios)) if len(logratios) > 1 else 0
+            txt = "%-8s %+6.1f%% (95%% CI: %+.1f%% .. %+.1f%%) over %d files" % (m, 100 * (math.exp(g) - 1), 100 * (math.exp(g - h) - 1), 100 * (math.exp(g + h) - 1), len(logratios))
+            if g - h > math.log(1 + THRESHOLD):
+                txt = color.text(txt, False)
+                regressions.append("global " + txt)
+            elif g + h < math.log(1 - THRESHOLD):
+                txt = color.text(txt, True)
+            summary.append(txt)
+
+    return regressions, slower, faster, summary
+
+def usage():
+    print("Usage: ", os.path.basename(__file__), " [<options>] <baseline file> <bench json>")
+    print("Compare curvebench results with baseline (exit code is 1 if a regression is found)")
+    print("Options :")
+    print("-u : store results as new baseline (no comparison)")
+    print("-t <ratio> : minimum relative change to report (default: %.2f)" % THRESHOLD)
+    print("-v : verbose (display all comparisons)")
+    exit(1)
+
+if __name__ == "__main__":
+    try:
+        opts, args =  getopt.getopt(sys.argv[1:], 'ut:vh')
+    except:
+        usage()
+
+    update = False
+    verbose = False
+    for o, a in opts:
+        if o == "-u":
+            update = True
+        elif o == "-t":
+            THRESHOLD = float(a)
+        elif o == "-v":
+            verbose = True
+        else:
+            usage()
+
+    if len(args) != 2: usage()
+    base_file, bench_file = args
+
+    new, options = load_bench(bench_file)
+
+    if update:
+        pickle.dump(dict(results = new, options = options), open(base_file, 'wb'))
+        print("Baseline saved: %d files" % len(new))
+        exit(0)
+
+    if not os.path.isfile(base_file):
+        print("No baseline file (use -u option to create one)")
+        exit(2)
+
+    db = pickle.load(open(base_file, 'rb'))
+    base = db["results"]
+    if db.get("options") != options:
+        print("Warning: benchmark options differ from baseline: %s / %s" % (db.get("options"), options))
+
+    color = False
+    if sys.stdout.isatty():
+        import curses
+        curses.setupterm()
+        color = curses.tigetnum("colors") > 2
+    c = Color(color)
+
+    runs = min([ len(x["latency"]) for x in new.values() ] + [ len(x["latency"]) for x in base.values() ] or [ 0 ])
+    if runs < 3: print("Warning: few runs per file (%d), use curvebench -r option for reliable results" % runs)
+
+    regressions, slower, faster, summary = compare(base, new, c, verbose = verbose)
+
+    if faster:
+        print("### Per-file improvements (information only):")
+        for l in faster: print(c.text(l, True))
+    if slower:
+        print("### Per-file regressions (information only):")
+        for l in slower: print(c.text(l, False))
+
+    print("### Performance comparison (%d files, threshold %.0f%%)" % (len([ k for k in new if k in base ]), 100 * THRESHOLD))
+    for s in summary: print(s)
+
+    print("Regression detected" if regressions else "No regression")
+    exit(1 if regressions else 0)
@@ -0,0 +1,213 @@
+#! /usr/bin/python3
+# -*- coding: utf-8 -*-
+
+# dictionary size scaling benchmark: build word trees of increasing size
+# (random subsamples of one or more word lists, e.g. "db/tmp-words-en.txt"
+# or merged languages / user vocabularies), replay the same gesture set with
+# curvebench against each tree, and tabulate matching cost against
+# vocabulary size:
+#   tools/bench_scaling.py -w db/tmp-words-en.txt -w db/tmp-words-fr.txt test/*.json
+#
+# Subsamples are nested (each tree includes all words of the smaller ones)
+# and always include expected words of test cases, so each gesture has the
+# same target word for all sizes. Trees are cached in the work directory and
+# only rebuilt when their contents change.
+# Growth exponent is the slope of log(metric) / log(words), i.e. 1.0 means
+# cost is proportional to dictionary size
+
+import os, sys
+import re
+import json
+import math
+import random
+import struct
+import getopt
+import hashlib
+import subprocess
+import unicodedata
+
+DIR = os.path.dirname(os.path.abspath(__file__))
+CURVEBENCH = os.path.join(DIR, "..", "bench", "build", "curvebench")
+LOADKB = os.path.join(DIR, "loadkb.py")
+
+SIZES = [ 30000, 60000, 125000, 250000, 500000 ]
+METRICS = [ ("latency", "ms"), ("cputime", "ms"), ("count", "nodes"), ("mem_peak", "KB") ]
+
+def letters(word):
+    """ same conversion as gribouille.py: tree path for a word """
+    w = ''.join(c for c in unicodedata.normalize('NFD', word) if unicodedata.category(c) != 'Mn')
+    w = re.sub(r'[^a-z]', '', w.lower())
+    return re.sub(r'(.)\1+', lambda m: m.group(1), w)
+
+def expected_word(fname):
+    """ expected word from test case file name (same rules as tools/optim.py) """
+    name = re.sub(r'\.json$', '', os.path.basename(fname))
+    name = re.sub(r'^[a-z][a-z]-(.)', r'\1', name)
+    name = re.sub(r'-.*$', '', name)
+    return re.sub(r'[0-9]+$', '', name)
+
+# binary gesture files layout (must match curve/replay.h)
+REPLAY_MAGIC = 0x474b424f # "OKBG"
+REPLAY_VERSION = 1
+REPLAY_HEADER = struct.Struct("=6I") # magic, version, gesture_count, params_count, params_index, gesture_index
+REPLAY_GESTURE = struct.Struct("=IiIIIiffii64s32s64s") # size, id, params, key_count, point_count, dpi,
+                                                      # screen_x, screen_y, pixels_x, pixels_y, name, expected, treefile
+REPLAY_GESTURE_EXPECTED = 11 # field index of expected word
+
+def replay_expected(fname):
+    """ expected words from a binary gesture file """
+    data = open(fname, 'rb').read()
+    magic, version, count, params_count, params_index, gesture_index = REPLAY_HEADER.unpack_from(data, 0)
+    if magic != REPLAY_MAGIC or version != REPLAY_VERSION:
+        raise Exception("Unsupported gesture file (version %d, expected %d): %s" % (version, REPLAY_VERSION, fname))
+    result = []
+    for i in range(count):
+        offset = struct.unpack_from("=I", data, gesture_index + 4 * i)[0]
+        expected = REPLAY_GESTURE.unpack_from(data, offset)[REPLAY_GESTURE_EXPECTED]
+        expected = expected.split(b'\0')[0].decode('utf-8', 'replace')
+        if expected: result.append(expected)
+    return result
+
+def is_replay(fname):
+    with open(fname, 'rb') as f: return f.read(4) == struct.pack("=I", REPLAY_MAGIC)
+
+def load_words(fnames):
+    """ word lists: one word per line (other columns, e.g. counts, are ignored) """
+    words, seen = [], set()
+    for fname in fnames:
+        for line in open(fname, encoding = 'utf-8', errors = 'replace'):
+            l = line.split()
+            if not l or l[0] in seen: continue
+            seen.add(l[0])
+            words.append(l[0])
+    return words
+
+def build_tree(fname, words):
+    with open(fname + ".txt", "w", encoding = 'utf-8') as f:
+        for w in words: f.write(w + "\n")
+    with open(fname + ".txt") as f:
+        subprocess.check_call([ LOADKB, fname ], stdin = f, stdout = subprocess.DEVNULL)
+    os.unlink(fname + ".txt")
+
+def mean(l):
+    return sum(l) / len(l) if l else 0
+
+def percentile(l, p):
+    if not l: return 0
+    l = sorted(l)
+    return l[min(len(l) - 1, int(p * len(l)))]
+
+def slope(xs, ys):
+    """ least squares slope on log-log scale """
+    pts = [ (math.log(x), math.log(y)) for x, y in zip(xs, ys) if x > 0 and y > 0 ]
+    if len(pts) < 2: return None
+    mx, my = mean([ p[0] for p in pts ]), mean([ p[1] for p in pts ])
+    sxx = sum([ (p[0] - mx) ** 2 for p in pts ])
+    if not sxx: return None
+    return sum([ (p[0] - mx) * (p[1] - my) for p in pts ]) / sxx
+
+def usage():
+    print("Usage: ", os.path.basename(__file__), " [<options>] -w <word list> [-w <word list> ...] <test json or gesture file> ...")
+    print("Replay test cases against word trees of increasing size")
+    print("Options :")
+    print("-w <file> : word list (one word per line, several lists are merged)")
+    print("-s <sizes> : comma separated vocabulary sizes (default: %s)" % ",".join([ str(s) for s in SIZES ]))
+    print("-d <dir> : work directory for trees & results (default: /tmp/okb-scaling)")
+    print("-e <seed> : random seed for subsampling (default: 1)")
+    print("-r <count> : curvebench runs per tree (default: 1)")
+    print("-x <factor> : replay speed (default: 0 = no delay between points)")
+    print("-t <ms> : deadline for final matching")
+    print("-o <file> : write results as JSON")
+    print("-c <file> : write results as CSV (e.g. for gnuplot)")
+    print("-b <path> : curvebench binary (default: %s)" % CURVEBENCH)
+    exit(1)
+
+if __name__ == "__main__":
+    try:
+        opts, args =  getopt.getopt(sys.argv[1:], 'w:s:d:e:r:x:t:o:c:b:h')
+    except:
+        usage()
+
+    wordlists = []
+    sizes = SIZES
+    workdir = "/tmp/okb-scaling"
+    seed = 1
+    bench_opts = [ "-x", "0", "-m" ]
+    output = csv = None
+    curvebench = CURVEBENCH
+    for o, a in opts:
+        if o == "-w": wordlists.append(a)
+        elif o == "-s": sizes = sorted([ int(x) for x in a.split(",") ])
+        elif o == "-d": workdir = a
+        elif o == "-e": seed = int(a)
+        elif o == "-r": bench_opts += [ "-r", a ]
+        elif o == "-x": bench_opts[1] = a
+        elif o == "-t": bench_opts += [ "-t", a ]
+        elif o == "-o": output = a
+        elif o == "-c": csv = a
+        elif o == "-b": curvebench = a
+        else: usage()
+
+    if not wordlists or not args: usage()
+    if not os.path.isfile(curvebench):
+        print("curvebench not found: %s (build it with tools/bench.sh or use -b option)" % curvebench)
+        exit(2)
+    if not os.path.isdir(workdir): os.makedirs(workdir)
+
+    # expected words are always included
+    expected = set()
+    for fname in args:
+        if is_replay(fname): expected.update(replay_expected(fname))
+        else: expected.add(expected_word(fname))
+    expected = set([ w for w in expected if len(letters(w)) >= 2 ])
+
+    words = load_words(wordlists)
+    random.seed(seed)
+    random.shuffle(words)
+    words = sorted(expected) + [ w for w in words if w not in expected ]
+    if sizes[-1] > len(words):
+        print("Warning: only %d words available" % len(words))
+        sizes = sorted(set([ min(s, len(words)) for s in sizes ]))
+
+    results = []
+    for size in sizes:
+        tree = os.path.join(workdir, "words-%d.tre" % size)
+        stamp_file = tree + ".stamp"
+        stamp = hashlib.md5("\n".join(words[:size]).encode('utf-8')).hexdigest() # tree contents
+        if not os.path.isfile(tree) or not os.path.isfile(stamp_file) or open(stamp_file).read() != stamp:
+            print("Building tree: %d words" % size)
+            build_tree(tree, words[:size])
+            open(stamp_file, "w").write(stamp)
+
+        print("Replaying %d test files: %d words" % (len(args), size))
+        bench_file = os.path.join(workdir, "bench-%d.json" % size)
+        subprocess.check_call([ curvebench ] + bench_opts + [ "-o", bench_file, tree ] + args, stdout = subprocess.DEVNULL)
+        js = json.loads(open(bench_file).read())
+
+        r = dict(words = size, tree_size = os.path.getsize(tree), gestures = len(js["gestures"]))
+        for m, unit in METRICS:
+            values = [ float(g.get(m, 0)) for g in js["gestures"] ]
+            if m == "mem_peak": values = [ v / 1024 for v in values ]
+            r[m] = mean(values)
+            r[m + "_p95"] = percentile(values, 0.95)
+        results.append(r)
+
+    print()
+    print("%10s %10s" % ("words", "tree (KB)") + "".join([ " %14s %8s" % ("%s (%s)" % (m, u), "p95") for m, u in METRICS ]))
+    for r in results:
+        print("%10d %10d" % (r["words"], r["tree_size"] / 1024) + "".join([ " %14.1f %8.1f" % (r[m], r[m + "_p95"]) for m, u in METRICS ]))
+
+    growth = dict()
+    for m, unit in [ ("tree_size", "") ] + METRICS:
+        growth[m] = slope([ r["words"] for r in results ], [ r[m] for r in results ])
+    print("%-21s" % "growth exponent" + "".join([ " %14s %8s" % ("%.2f" % growth[m] if growth[m] is not None else "-", "") for m, u in METRICS ]))
+    if growth["tree_size"] is not None: print("(tree size growth exponent: %.2f)" % growth["tree_size"])
+
+    if output:
+        with open(output, "w") as f: f.write(json.dumps(dict(wordlists = wordlists, seed = seed, options = bench_opts,
+                                                             results = results, growth = growth), indent = 2))
+    if csv:
+        cols = [ "words", "tree_size" ] + sum([ [ m, m + "_p95" ] for m, u in METRICS ], [])
+        with open(csv, "w") as f:
+            f.write(";".join(cols) + "\n")
+            for r in results: f.write(";".join([ str(r[c]) for c in cols ]) + "\n")
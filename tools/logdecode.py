@@ -0,0 +1,36 @@
+#! /usr/bin/python3
+# -*- coding: utf-8 -*-
+
+# convert a binary curve plugin log file (cf. setLogLevel() and curve/log.cpp)
+# to the usual text format
+
+import sys, os
+import struct
+
+HEADER = struct.Struct("=cBBBII")  # magic, level, type, reserved, timestamp (ms), length
+
+if len(sys.argv) < 2:
+    print("usage:", os.path.basename(__file__), "[-t] <binary log file>")
+    print(" -t : prefix lines with timestamp (ms) and level")
+    exit(1)
+
+timestamps = False
+if sys.argv[1] == "-t":
+    timestamps = True
+    sys.argv.pop(1)
+
+with open(sys.argv[1], "rb") as f:
+    data = f.read()
+
+pos = 0
+while pos + HEADER.size <= len(data):
+    (magic, level, typ, _, ts, length) = HEADER.unpack_from(data, pos)
+    if magic != b'R':
+        raise Exception("bad record at offset %d" % pos)
+    pos += HEADER.size
+    txt = data[pos:pos + length].decode("utf-8", errors="replace")
+    pos += length
+    if timestamps:
+        print("[%d.%03d:%d] %s" % (ts // 1000, ts % 1000, level, txt))
+    else:
+        print(txt)
@@ -23,7 +23,7 @@ import params
 import pickle
 import tempfile
 
-CLI = "../cli/build/cli"
+CLI = os.getenv("OKB_CLI", "../cli/build/cli")  # override to compare with another build
 TRE_DIR = "../db"
 TEST_DIR = "../test"
 LOG = None  # "/tmp/optim.log"
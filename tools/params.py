@@ -18,7 +18,10 @@ defparams = [
     [ "atp_pt_61", float, 0, 1],
     [ "atp_threshold", int, 1, 20],
     [ "bad_tangent_score", float ],  # population too small for optimization (4 strokes!)
+    [ "beam_min_scenarios", int ],  # adaptive beam width: lower bound for max_active_scenarios
+    [ "beam_target_ms", int ],  # adaptive beam width: target time (ms) for an incremental iteration (0 = disabled)
     [ "bjr_min_turn", int, 90, 180],
+    [ "bucket_length_ratio", float ],  # start/end key & length buckets: accepted length ratio between gesture and ideal word path (0 = disabled)
     [ "cat_window", int ],  # no optim, larger is better (and slower)
     [ "cls_distance_max_ratio", float, 0, 2 ],
     [ "cls_enable", int ],
@@ -53,6 +56,9 @@ defparams = [
     [ "dst_x_max", int, 0, 100 ],
     [ "dst_y_add", int, 0, 50 ],
     [ "dst_y_max", int, 0, 200 ],
+    [ "early_max_depth", int ],  # max remaining tree depth below leading scenario for early result
+    [ "early_min_count", int ],
+    [ "early_score_gap", float ],  # 0 = disabled
     [ "end_scenario_wait", int ],
     [ "error_correct", int ],
     [ "error_ignore_count", int, 3, 10 ],
@@ -60,6 +66,7 @@ defparams = [
     [ "fallback_min_length", int ],
     [ "fallback_start_count", int ],
     [ "fallback_snapshot_queue", int ],
+    [ "fallback_threads", int ],  # 1 = serial (default), 0 = use all cores
     [ "fallback_timeout", int ],
     [ "final_coef_misc", float ],  # only optimize individual scores
     [ "final_coef_turn", float, 0.1, 30 ],
@@ -95,12 +102,14 @@ defparams = [
     [ "hint_v_minturn", int, 10, 70 ],
     [ "hint_v_minturn2", int, 10, 70 ],
     [ "hint_v_range", int, 3, 10 ],
+    [ "incr_idle_aggressive", float ],  # speculative matching while waiting for points (0 = disabled, default: results then depend on matcher idle time, which the test suite does not reproduce)
     [ "incr_retry", int ],  # no optim => performance only
     [ "incremental_index_gap", int ],
     [ "incremental_length_lag", int ],  # no optimization
     [ "inf_max", int, 40, 180 ],
     [ "inf_min", int, 5, 40 ],
     [ "inter_pt_min_dist", int, 5, 80 ],
+    [ "key_pass", int ],  # key pass index (0 = disabled, for comparisons)
     [ "key_shift_ema_coef", float, 0, 0.1 ],
     [ "key_shift_enable", int ],
     [ "key_shift_ratio", float, 0, 1.5 ],
@@ -119,6 +128,7 @@ defparams = [
     [ "max_segment_length", int ],
     [ "max_star_index", int, 3, 20 ],
     [ "max_turn_index_gap", int, 2, 10],
+    [ "mem_stats", int ],  # memory accounting (0 = disabled, only useful for benchmarks)
     [ "min_turn_index_gap", int, 1, 5],
     [ "min_turn_index_gap_st", int, 1, 5],
     [ "multi_dot_threshold", int ],
@@ -156,6 +166,9 @@ defparams = [
     [ "scaling_size_pow", float, 0.2, 5 ],
     [ "score_pow", float, 0.1, 10 ],
     [ "sharp_turn_penalty", float, 0, 1 ],
+    [ "shortlist_min_words", int ],  # template shortlist: only used with dictionaries larger than this
+    [ "shortlist_samples", int ],  # template shortlist: number of sample points for each word path
+    [ "shortlist_size", int ],  # template shortlist: number of words to keep (0 = disabled)
     [ "slow_down_max_turn", int, 1, 10 ],
     [ "slow_down_ratio", float, 1, 10 ],
     [ "small_segment_min_score", float, 0.01, 0.9 ],
@@ -218,6 +231,7 @@ defparams = [
     [ "ut_score", float, 0, 1 ],
     [ "ut_total", int, 20, 90 ],
     [ "ut_turn", int, 5, 45 ],
+    [ "warm_restore", int ],  # restore dictionary from warm snapshot (mmap) instead of rebuilding it after auto-unload
     [ "weight_cos", float, 0.1, 10 ],
     [ "weight_curve", float, 0.1, 10 ],
     [ "weight_distance", float ],  # reference (=1)